@@ -0,0 +1,425 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "async_log.h"
+
+#define POLL_PERIOD_MS					2
+
+#define SPEC_MAX_LEN					16
+
+typedef enum {
+	ARG_NONE = 0,	// "%%"
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_DOUBLE,
+	ARG_PTR,
+	ARG_STR,	// Copied to the arena
+	ARG_UNSUPPORTED,
+} arg_type_t;
+
+typedef union {
+	unsigned int i;
+	unsigned long l;
+	unsigned long long ll;
+	size_t z;
+	double d;
+	void *p;
+	char *s;
+} log_arg_t;
+
+typedef struct {
+	FILE *fp;
+	char *fmt; // NULL if the record was formatted by the producer (args[0].s)
+	uint32_t arena_end; // Arena head once the record was pushed
+	log_arg_t args[ASYNC_LOG_MAX_ARGS];
+} log_record_t;
+
+/* Single producer (emulation thread), single consumer (logging thread) queue.
+ * The producer only writes the head and the consumer only writes the tail,
+ * so no lock is needed.
+ */
+static log_record_t g_queue[ASYNC_LOG_QUEUE_SIZE];
+static SDL_atomic_t g_head = {0};
+static SDL_atomic_t g_tail = {0};
+static SDL_atomic_t g_dropped = {0};
+static SDL_atomic_t g_running = {0};
+
+/* Strings referenced by the records, allocated the same way: the producer
+ * owns the head, the consumer releases up to the end of each record it is
+ * done with.
+ */
+static char g_arena[ASYNC_LOG_ARENA_SIZE];
+static uint32_t g_arena_head = 0;
+static SDL_atomic_t g_arena_tail = {0};
+
+static SDL_Thread *g_thread = NULL;
+
+
+/* Parses the conversion found at fmt (right after a '%'), returns the
+ * character following it
+ */
+static char * parse_spec(char *fmt, arg_type_t *type)
+{
+	char *start = fmt;
+	int longs = 0;
+	int size = 0;
+
+	if (*fmt == '%') {
+		*type = ARG_NONE;
+		return fmt + 1;
+	}
+
+	/* Flags, width and precision */
+	while (*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != NULL) {
+		fmt++;
+	}
+
+	/* Length modifiers */
+	if (*fmt == 'h') {
+		fmt += (fmt[1] == 'h') ? 2 : 1;
+	} else if (*fmt == 'l') {
+		longs = (fmt[1] == 'l') ? 2 : 1;
+		fmt += longs;
+	} else if (*fmt == 'z') {
+		size = 1;
+		fmt++;
+	}
+
+	if (*fmt == '\0' || fmt - start >= SPEC_MAX_LEN - 2) {
+		*type = ARG_UNSUPPORTED;
+		return fmt;
+	}
+
+	if (strchr("diouxXc", *fmt) != NULL) {
+		*type = size ? ARG_SIZE : ((longs == 2) ? ARG_LLONG : ((longs == 1) ? ARG_LONG : ARG_INT));
+	} else if (strchr("fFeEgGaA", *fmt) != NULL && !longs && !size) {
+		*type = ARG_DOUBLE;
+	} else if (*fmt == 'p' && !longs && !size) {
+		*type = ARG_PTR;
+	} else if (*fmt == 's' && !longs && !size) {
+		*type = ARG_STR;
+	} else {
+		/* Wide strings, '*' width or precision, %n... */
+		*type = ARG_UNSUPPORTED;
+	}
+
+	return fmt + 1;
+}
+
+/* Returns the number of arguments consumed by the format, -1 if they
+ * cannot be stored as is
+ */
+static int count_args(char *fmt)
+{
+	arg_type_t type;
+	int num = 0;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		fmt = parse_spec(fmt + 1, &type);
+
+		if (type == ARG_UNSUPPORTED) {
+			return -1;
+		} else if (type != ARG_NONE) {
+			num++;
+		}
+	}
+
+	return (num <= ASYNC_LOG_MAX_ARGS) ? num : -1;
+}
+
+/* Strings never wrap around the end of the arena */
+static char * arena_alloc(uint32_t len)
+{
+	uint32_t offset = g_arena_head & (ASYNC_LOG_ARENA_SIZE - 1);
+	uint32_t skip = 0;
+
+	if (offset + len > ASYNC_LOG_ARENA_SIZE) {
+		skip = ASYNC_LOG_ARENA_SIZE - offset;
+	}
+
+	if (g_arena_head + skip + len - (uint32_t) SDL_AtomicGet(&g_arena_tail) > ASYNC_LOG_ARENA_SIZE) {
+		return NULL;
+	}
+
+	g_arena_head += skip + len;
+
+	return &g_arena[(g_arena_head - len) & (ASYNC_LOG_ARENA_SIZE - 1)];
+}
+
+static char * arena_strdup(char *str)
+{
+	uint32_t len = strlen(str) + 1;
+	char *copy;
+
+	copy = arena_alloc(len);
+	if (copy != NULL) {
+		memcpy(copy, str, len);
+	}
+
+	return copy;
+}
+
+/* Only copies the arguments, unless the format is not supported */
+static int fill_record(log_record_t *record, char *fmt, va_list args)
+{
+	arg_type_t type;
+	va_list args_copy;
+	char *f = fmt;
+	int num, len, i = 0;
+
+	num = count_args(fmt);
+	if (num < 0) {
+		record->fmt = NULL;
+
+		va_copy(args_copy, args);
+		len = vsnprintf(NULL, 0, fmt, args_copy);
+		va_end(args_copy);
+
+		if (len < 0 || (record->args[0].s = arena_alloc(len + 1)) == NULL) {
+			return -1;
+		}
+
+		vsnprintf(record->args[0].s, len + 1, fmt, args);
+		return 0;
+	}
+
+	record->fmt = fmt;
+
+	while ((f = strchr(f, '%')) != NULL) {
+		f = parse_spec(f + 1, &type);
+
+		switch (type) {
+			case ARG_INT:
+				record->args[i++].i = va_arg(args, unsigned int);
+				break;
+
+			case ARG_LONG:
+				record->args[i++].l = va_arg(args, unsigned long);
+				break;
+
+			case ARG_LLONG:
+				record->args[i++].ll = va_arg(args, unsigned long long);
+				break;
+
+			case ARG_SIZE:
+				record->args[i++].z = va_arg(args, size_t);
+				break;
+
+			case ARG_DOUBLE:
+				record->args[i++].d = va_arg(args, double);
+				break;
+
+			case ARG_PTR:
+				record->args[i++].p = va_arg(args, void *);
+				break;
+
+			case ARG_STR:
+				record->args[i].s = arena_strdup(va_arg(args, char *));
+				if (record->args[i++].s == NULL) {
+					return -1;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+void async_log_push(FILE *fp, char *fmt, va_list args)
+{
+	uint32_t head = (uint32_t) SDL_AtomicGet(&g_head);
+	uint32_t arena_head = g_arena_head;
+	log_record_t *record;
+
+	if (head - (uint32_t) SDL_AtomicGet(&g_tail) >= ASYNC_LOG_QUEUE_SIZE) {
+		/* The consumer is late, do not slow down the emulation */
+		SDL_AtomicAdd(&g_dropped, 1);
+		return;
+	}
+
+	record = &g_queue[head & (ASYNC_LOG_QUEUE_SIZE - 1)];
+	record->fp = fp;
+
+	if (fill_record(record, fmt, args) < 0) {
+		/* Same if the arena is full */
+		g_arena_head = arena_head;
+		SDL_AtomicAdd(&g_dropped, 1);
+		return;
+	}
+
+	record->arena_end = g_arena_head;
+
+	/* Publish the record */
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&g_head, head + 1);
+}
+
+static void write_record(log_record_t *r)
+{
+	char spec[SPEC_MAX_LEN];
+	char *fmt = r->fmt, *end;
+	arg_type_t type;
+	int i = 0;
+
+	if (fmt == NULL) {
+		fputs(r->args[0].s, r->fp);
+		return;
+	}
+
+	/* One conversion at a time, as the arguments cannot be given back as
+	 * a va_list
+	 */
+	while ((end = strchr(fmt, '%')) != NULL) {
+		fwrite(fmt, 1, end - fmt, r->fp);
+
+		fmt = parse_spec(end + 1, &type);
+
+		memcpy(spec, end, fmt - end);
+		spec[fmt - end] = '\0';
+
+		switch (type) {
+			case ARG_NONE:
+				fputc('%', r->fp);
+				break;
+
+			case ARG_INT:
+				fprintf(r->fp, spec, r->args[i++].i);
+				break;
+
+			case ARG_LONG:
+				fprintf(r->fp, spec, r->args[i++].l);
+				break;
+
+			case ARG_LLONG:
+				fprintf(r->fp, spec, r->args[i++].ll);
+				break;
+
+			case ARG_SIZE:
+				fprintf(r->fp, spec, r->args[i++].z);
+				break;
+
+			case ARG_DOUBLE:
+				fprintf(r->fp, spec, r->args[i++].d);
+				break;
+
+			case ARG_PTR:
+				fprintf(r->fp, spec, r->args[i++].p);
+				break;
+
+			case ARG_STR:
+				fprintf(r->fp, spec, r->args[i++].s);
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	fputs(fmt, r->fp);
+}
+
+static int drain(void)
+{
+	uint32_t tail = (uint32_t) SDL_AtomicGet(&g_tail);
+	uint32_t head = (uint32_t) SDL_AtomicGet(&g_head);
+	log_record_t *r;
+
+	if (tail == head) {
+		return 0;
+	}
+
+	SDL_MemoryBarrierAcquire();
+
+	for (; tail != head; tail++) {
+		r = &g_queue[tail & (ASYNC_LOG_QUEUE_SIZE - 1)];
+
+		/* Keep the order between the streams */
+		if (r->fp != stdout) {
+			fflush(stdout);
+		}
+
+		write_record(r);
+		SDL_AtomicSet(&g_arena_tail, r->arena_end);
+	}
+
+	SDL_AtomicSet(&g_tail, tail);
+
+	return 1;
+}
+
+static int log_thread(void *data)
+{
+	while (SDL_AtomicGet(&g_running)) {
+		if (!drain()) {
+			fflush(stdout);
+			SDL_Delay(POLL_PERIOD_MS);
+		}
+	}
+
+	/* Whatever was queued before stopping */
+	drain();
+	fflush(stdout);
+
+	return 0;
+}
+
+int async_log_start(void)
+{
+	SDL_AtomicSet(&g_running, 1);
+
+	g_thread = SDL_CreateThread(&log_thread, "log", NULL);
+	if (g_thread == NULL) {
+		fprintf(stderr, "FATAL: Cannot create the logging thread: %s !\n", SDL_GetError());
+		SDL_AtomicSet(&g_running, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+void async_log_stop(void)
+{
+	uint32_t dropped;
+
+	if (g_thread == NULL) {
+		return;
+	}
+
+	SDL_AtomicSet(&g_running, 0);
+	SDL_WaitThread(g_thread, NULL);
+	g_thread = NULL;
+
+	dropped = (uint32_t) SDL_AtomicGet(&g_dropped);
+	if (dropped > 0) {
+		fprintf(stderr, "%u log records dropped !\n", dropped);
+	}
+}
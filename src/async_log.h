@@ -0,0 +1,35 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _ASYNC_LOG_H_
+#define _ASYNC_LOG_H_
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#define ASYNC_LOG_QUEUE_SIZE		8192 // Must be a power of 2
+#define ASYNC_LOG_MAX_ARGS		8
+#define ASYNC_LOG_ARENA_SIZE		65536 // Must be a power of 2
+
+
+int async_log_start(void);
+void async_log_push(FILE *fp, char *fmt, va_list args);
+void async_log_stop(void);
+
+#endif /* _ASYNC_LOG_H_ */
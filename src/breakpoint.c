@@ -0,0 +1,604 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lib/tamalib.h"
+
+#include "breakpoint.h"
+
+typedef enum {
+	OPERAND_A = 0,
+	OPERAND_B,
+	OPERAND_X,
+	OPERAND_Y,
+	OPERAND_SP,
+	OPERAND_NP,
+	OPERAND_F,
+	OPERAND_MEM,
+} operand_t;
+
+typedef enum {
+	COND_EQ = 0,
+	COND_NE,
+	COND_LT,
+	COND_LE,
+	COND_GT,
+	COND_GE,
+} cond_op_t;
+
+typedef struct {
+	operand_t operand;
+	u12_t addr; // For OPERAND_MEM
+	cond_op_t op;
+	u32_t value;
+} cond_t;
+
+typedef struct {
+	u12_t addr;
+	u8_t type;
+	u4_t old_val;
+} access_t;
+
+u32_t g_bp_bitmap[BP_PC_NUM / 32] = {0};
+
+static uint32_t g_num = 0;
+
+/* Condition index + 1 for each breakpoint, 0 if unconditional */
+static u8_t g_bp_conds[BP_PC_NUM] = {0};
+static cond_t g_conds[BP_COND_MAX];
+static uint32_t g_num_conds = 0;
+
+/* Watched access types for each memory address, the watchpoints only
+ * counting the read and write ones
+ */
+static u8_t g_wp_flags[MEMORY_SIZE] = {0};
+static uint32_t g_num_wp = 0;
+
+/* Watched accesses of the instruction about to be executed */
+static access_t g_accesses[WP_ACCESS_MAX];
+static uint32_t g_num_accesses = 0;
+
+static const struct {
+	char *str;
+	operand_t operand;
+} operands[] = {
+	{"A", OPERAND_A},
+	{"B", OPERAND_B},
+	{"X", OPERAND_X},
+	{"Y", OPERAND_Y},
+	{"SP", OPERAND_SP},
+	{"NP", OPERAND_NP},
+	{"F", OPERAND_F},
+};
+
+/* Two-character operators first */
+static const struct {
+	char *str;
+	cond_op_t op;
+} cond_ops[] = {
+	{"==", COND_EQ},
+	{"!=", COND_NE},
+	{"<=", COND_LE},
+	{">=", COND_GE},
+	{"<", COND_LT},
+	{">", COND_GT},
+};
+
+
+static int parse_cond(char *str, cond_t *cond)
+{
+	char *end;
+	unsigned long addr;
+	uint32_t i, len;
+
+	/* <operand><op><value>, operand being a register or M[<addr>] */
+	if (!strncmp(str, "M[", 2)) {
+		addr = strtoul(str + 2, &end, 0);
+		if (end == str + 2 || *end != ']' || addr >= MEMORY_SIZE) {
+			return -1;
+		}
+
+		cond->operand = OPERAND_MEM;
+		cond->addr = addr;
+		str = end + 1;
+	} else {
+		for (i = 0; i < sizeof(operands)/sizeof(operands[0]); i++) {
+			len = strlen(operands[i].str);
+			if (!strncmp(str, operands[i].str, len) && strchr("=!<>", str[len]) != NULL) {
+				break;
+			}
+		}
+
+		if (i == sizeof(operands)/sizeof(operands[0])) {
+			return -1;
+		}
+
+		cond->operand = operands[i].operand;
+		str += len;
+	}
+
+	for (i = 0; i < sizeof(cond_ops)/sizeof(cond_ops[0]); i++) {
+		len = strlen(cond_ops[i].str);
+		if (!strncmp(str, cond_ops[i].str, len)) {
+			break;
+		}
+	}
+
+	if (i == sizeof(cond_ops)/sizeof(cond_ops[0])) {
+		return -1;
+	}
+
+	cond->op = cond_ops[i].op;
+	str += len;
+
+	cond->value = strtoul(str, &end, 0);
+	if (end == str || *end != '\0') {
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool_t eval_cond(cond_t *cond)
+{
+	state_t *state = tamalib_get_state();
+	u32_t val = 0;
+
+	switch (cond->operand) {
+		case OPERAND_A:
+			val = *(state->a);
+			break;
+
+		case OPERAND_B:
+			val = *(state->b);
+			break;
+
+		case OPERAND_X:
+			val = *(state->x);
+			break;
+
+		case OPERAND_Y:
+			val = *(state->y);
+			break;
+
+		case OPERAND_SP:
+			val = *(state->sp);
+			break;
+
+		case OPERAND_NP:
+			val = *(state->np);
+			break;
+
+		case OPERAND_F:
+			val = *(state->flags);
+			break;
+
+		case OPERAND_MEM:
+			val = GET_MEMORY(state->memory, cond->addr);
+			break;
+	}
+
+	switch (cond->op) {
+		case COND_EQ:
+			return val == cond->value;
+
+		case COND_NE:
+			return val != cond->value;
+
+		case COND_LT:
+			return val < cond->value;
+
+		case COND_LE:
+			return val <= cond->value;
+
+		case COND_GT:
+			return val > cond->value;
+
+		case COND_GE:
+			return val >= cond->value;
+	}
+
+	return 0;
+}
+
+int bp_add(u13_t pc)
+{
+	if (pc >= BP_PC_NUM) {
+		return -1;
+	}
+
+	if (!bp_is_set(pc)) {
+		g_bp_bitmap[pc >> 5] |= 1U << (pc & 0x1F);
+		g_num++;
+	}
+
+	/* An unconditional breakpoint overrides a conditional one */
+	g_bp_conds[pc] = 0;
+
+	return 0;
+}
+
+int bp_add_str(char *str)
+{
+	char *end;
+	unsigned long pc;
+	cond_t cond;
+
+	/* <pc> or <pc>,<condition> */
+	pc = strtoul(str, &end, 0);
+	if (end == str || pc >= BP_PC_NUM) {
+		return -1;
+	}
+
+	if (*end == '\0') {
+		return bp_add(pc);
+	}
+
+	if (*end != ',' || parse_cond(end + 1, &cond) < 0 || g_num_conds >= BP_COND_MAX) {
+		return -1;
+	}
+
+	bp_add(pc);
+
+	g_conds[g_num_conds] = cond;
+	g_bp_conds[pc] = ++g_num_conds;
+
+	return 0;
+}
+
+void bp_remove(u13_t pc)
+{
+	if (pc >= BP_PC_NUM || !bp_is_set(pc)) {
+		return;
+	}
+
+	g_bp_bitmap[pc >> 5] &= ~(1U << (pc & 0x1F));
+	g_bp_conds[pc] = 0;
+	g_num--;
+}
+
+void bp_clear(void)
+{
+	memset(g_bp_bitmap, 0, sizeof(g_bp_bitmap));
+	memset(g_bp_conds, 0, sizeof(g_bp_conds));
+	g_num = 0;
+	g_num_conds = 0;
+}
+
+uint32_t bp_get_num(void)
+{
+	return g_num;
+}
+
+/* Returns 1 if the execution must stop at pc */
+bool_t bp_check(u13_t pc)
+{
+	if (!bp_is_set(pc)) {
+		return 0;
+	}
+
+	if (!g_bp_conds[pc]) {
+		return 1;
+	}
+
+	return eval_cond(&g_conds[g_bp_conds[pc] - 1]);
+}
+
+int wp_add(u12_t start, u12_t end, u8_t type)
+{
+	u12_t i;
+
+	if (start > end || end >= MEMORY_SIZE || !(type & (WP_READ | WP_WRITE))) {
+		return -1;
+	}
+
+	for (i = start; i <= end; i++) {
+		if (!(g_wp_flags[i] & (WP_READ | WP_WRITE))) {
+			g_num_wp++;
+		}
+
+		g_wp_flags[i] |= type;
+	}
+
+	return 0;
+}
+
+/* Writes to these addresses are decoded like watchpoints, but never stop
+ * the execution
+ */
+int wp_watch_add(u12_t start, u12_t end)
+{
+	u12_t i;
+
+	if (start > end || end >= MEMORY_SIZE) {
+		return -1;
+	}
+
+	for (i = start; i <= end; i++) {
+		g_wp_flags[i] |= WP_WATCH;
+	}
+
+	return 0;
+}
+
+int wp_add_str(char *str)
+{
+	char *end;
+	unsigned long start, stop;
+	u8_t type = WP_READ | WP_WRITE;
+
+	/* <addr>[-<addr>][,r|w|rw] */
+	start = strtoul(str, &end, 0);
+	if (end == str) {
+		return -1;
+	}
+
+	if (*end == '-') {
+		str = end + 1;
+		stop = strtoul(str, &end, 0);
+		if (end == str) {
+			return -1;
+		}
+	} else {
+		stop = start;
+	}
+
+	if (*end == ',') {
+		end++;
+		if (!strcmp(end, "r")) {
+			type = WP_READ;
+		} else if (!strcmp(end, "w")) {
+			type = WP_WRITE;
+		} else if (strcmp(end, "rw")) {
+			return -1;
+		}
+	} else if (*end != '\0') {
+		return -1;
+	}
+
+	if (start >= MEMORY_SIZE || stop >= MEMORY_SIZE) {
+		return -1;
+	}
+
+	return wp_add(start, stop, type);
+}
+
+void wp_remove(u12_t start, u12_t end, u8_t type)
+{
+	u12_t i;
+
+	if (start > end || end >= MEMORY_SIZE) {
+		return;
+	}
+
+	type &= WP_READ | WP_WRITE;
+
+	for (i = start; i <= end; i++) {
+		if ((g_wp_flags[i] & type) && !((g_wp_flags[i] &= ~type) & (WP_READ | WP_WRITE))) {
+			g_num_wp--;
+		}
+	}
+}
+
+uint32_t wp_get_num(void)
+{
+	return g_num_wp;
+}
+
+static void add_access(u12_t addr, u8_t type)
+{
+	state_t *state = tamalib_get_state();
+
+	/* Watched addresses only care about writes */
+	if (type & WP_WRITE) {
+		type |= WP_WATCH;
+	}
+
+	if (!(g_wp_flags[addr] & type) || g_num_accesses >= WP_ACCESS_MAX) {
+		return;
+	}
+
+	g_accesses[g_num_accesses].addr = addr;
+	g_accesses[g_num_accesses].type = g_wp_flags[addr] & type;
+	g_accesses[g_num_accesses].old_val = GET_MEMORY(state->memory, addr);
+	g_num_accesses++;
+}
+
+/* r/q operand (0=A, 1=B, 2=MX, 3=MY) */
+static void add_reg_access(u4_t r, u8_t type)
+{
+	state_t *state = tamalib_get_state();
+
+	if (r == 2) {
+		add_access(*(state->x), type);
+	} else if (r == 3) {
+		add_access(*(state->y), type);
+	}
+}
+
+/* The stack lives in the first 256 nibbles of the RAM */
+static void add_stack_access(int offset, u8_t type)
+{
+	state_t *state = tamalib_get_state();
+
+	add_access((u8_t) (*(state->sp) + offset), type);
+}
+
+/* Must be called before executing op, returns 1 if the instruction
+ * hits a watchpoint
+ */
+bool_t wp_match(u12_t op)
+{
+	state_t *state = tamalib_get_state();
+	u12_t x = *(state->x);
+	u12_t x_next = (x & 0xF00) | ((x + 1) & 0xFF);
+	u8_t r = (op >> 2) & 0x3, q = op & 0x3;
+	uint32_t i;
+
+	g_num_accesses = 0;
+
+	if ((op & 0xF00) == 0x100) {
+		/* RETD e */
+		add_stack_access(0, WP_READ);
+		add_stack_access(1, WP_READ);
+		add_stack_access(2, WP_READ);
+		add_access(x, WP_WRITE);
+		add_access(x_next, WP_WRITE);
+	} else if ((op & 0xE00) == 0x400) {
+		/* CALL s, CALZ s */
+		add_stack_access(-1, WP_WRITE);
+		add_stack_access(-2, WP_WRITE);
+		add_stack_access(-3, WP_WRITE);
+	} else if ((op & 0xF00) == 0x900) {
+		/* LBPX MX, e */
+		add_access(x, WP_WRITE);
+		add_access(x_next, WP_WRITE);
+	} else if (op >= 0xA80 && op <= 0xAEF) {
+		/* ADD, ADC, SUB, SBC, AND, OR, XOR r, q */
+		add_reg_access(q, WP_READ);
+		add_reg_access(r, WP_READ | WP_WRITE);
+	} else if ((op & 0xFF0) == 0xAF0) {
+		/* RLC r */
+		add_reg_access(q, WP_READ | WP_WRITE);
+	} else if (op >= 0xC00 && op <= 0xDFF) {
+		/* ADD, ADC, AND, OR, XOR, SBC, FAN, CP r, i and NOT r */
+		r = (op >> 4) & 0x3;
+		if ((op & 0xFC0) == 0xD80 || (op & 0xFC0) == 0xDC0) {
+			add_reg_access(r, WP_READ);
+		} else {
+			add_reg_access(r, WP_READ | WP_WRITE);
+		}
+	} else if (op >= 0xE00 && op <= 0xE3F) {
+		/* LD r, i */
+		add_reg_access((op >> 4) & 0x3, WP_WRITE);
+	} else if ((op & 0xFF0) == 0xE60) {
+		/* LDPX MX, i */
+		add_access(x, WP_WRITE);
+	} else if ((op & 0xFF0) == 0xE70) {
+		/* LDPY MY, i */
+		add_access(*(state->y), WP_WRITE);
+	} else if ((op & 0xFFC) == 0xE8C) {
+		/* RRC r */
+		add_reg_access(q, WP_READ | WP_WRITE);
+	} else if (op >= 0xE80 && op <= 0xE9F) {
+		/* LD XP/XH/XL/YP/YH/YL, r */
+		add_reg_access(q, WP_READ);
+	} else if (op >= 0xEA0 && op <= 0xEBF) {
+		/* LD r, XP/XH/XL/YP/YH/YL */
+		add_reg_access(q, WP_WRITE);
+	} else if ((op & 0xFF0) == 0xEC0 || (op & 0xFE0) == 0xEE0) {
+		/* LD, LDPX, LDPY r, q */
+		add_reg_access(q, WP_READ);
+		add_reg_access(r, WP_WRITE);
+	} else if ((op & 0xFE0) == 0xF00) {
+		/* CP, FAN r, q */
+		add_reg_access(q, WP_READ);
+		add_reg_access(r, WP_READ);
+	} else if ((op & 0xFE8) == 0xF28) {
+		/* ACPX, ACPY, SCPX, SCPY MX/MY, r */
+		add_reg_access(q, WP_READ);
+		add_reg_access((op & 0x4) ? 3 : 2, WP_READ | WP_WRITE);
+	} else if ((op & 0xFE0) == 0xF60) {
+		/* INC, DEC M(n) */
+		add_access(op & 0xF, WP_READ | WP_WRITE);
+	} else if ((op & 0xFE0) == 0xF80) {
+		/* LD M(n), A/B */
+		add_access(op & 0xF, WP_WRITE);
+	} else if ((op & 0xFE0) == 0xFA0) {
+		/* LD A/B, M(n) */
+		add_access(op & 0xF, WP_READ);
+	} else if (op >= 0xFC0 && op <= 0xFCA) {
+		/* PUSH */
+		if (op <= 0xFC3) {
+			add_reg_access(q, WP_READ);
+		}
+		add_stack_access(-1, WP_WRITE);
+	} else if (op >= 0xFD0 && op <= 0xFDA) {
+		/* POP */
+		add_stack_access(0, WP_READ);
+		if (op <= 0xFD3) {
+			add_reg_access(q, WP_WRITE);
+		}
+	} else if (op == 0xFDE || op == 0xFDF) {
+		/* RETS, RET */
+		add_stack_access(0, WP_READ);
+		add_stack_access(1, WP_READ);
+		add_stack_access(2, WP_READ);
+	} else if ((op & 0xFFC) == 0xFE0 || (op & 0xFFC) == 0xFF0) {
+		/* LD SPH/SPL, r */
+		add_reg_access(q, WP_READ);
+	} else if ((op & 0xFFC) == 0xFE4 || (op & 0xFFC) == 0xFF4) {
+		/* LD r, SPH/SPL */
+		add_reg_access(q, WP_WRITE);
+	}
+
+	for (i = 0; i < g_num_accesses; i++) {
+		if (g_accesses[i].type & (WP_READ | WP_WRITE)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns the accesses of the given type decoded by the last call to
+ * wp_match(), with the values found before the instruction
+ */
+uint32_t wp_get_accesses(u8_t type, u12_t *addrs, u4_t *old_vals)
+{
+	uint32_t i, num = 0;
+
+	for (i = 0; i < g_num_accesses; i++) {
+		if (g_accesses[i].type & type) {
+			addrs[num] = g_accesses[i].addr;
+			old_vals[num] = g_accesses[i].old_val;
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/* Must be called after executing the instruction found at pc, the
+ * accesses being reported through the given log function
+ */
+void wp_report(u13_t pc, void (*log_func)(log_level_t level, char *buff, ...))
+{
+	state_t *state = tamalib_get_state();
+	access_t *a;
+	uint32_t i;
+
+	for (i = 0; i < g_num_accesses; i++) {
+		a = &g_accesses[i];
+
+		if (!(a->type & (WP_READ | WP_WRITE))) {
+			continue;
+		}
+
+		if (a->type & WP_WRITE) {
+			log_func(LOG_INFO, "Watchpoint: 0x%03X written by 0x%04X (0x%X -> 0x%X)\n", a->addr, pc, a->old_val, GET_MEMORY(state->memory, a->addr));
+		} else {
+			log_func(LOG_INFO, "Watchpoint: 0x%03X read by 0x%04X (0x%X)\n", a->addr, pc, a->old_val);
+		}
+	}
+}
@@ -0,0 +1,57 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _BREAKPOINT_H_
+#define _BREAKPOINT_H_
+
+#include "lib/tamalib.h"
+
+#define BP_PC_NUM			(1 << 13)
+#define BP_COND_MAX			255
+
+#define WP_READ				0x1
+#define WP_WRITE			0x2
+#define WP_WATCH			0x4 // Writes recorded by the watch history
+#define WP_ACCESS_MAX			6
+
+/* One bit per program address */
+extern u32_t g_bp_bitmap[BP_PC_NUM / 32];
+
+static inline bool_t bp_is_set(u13_t pc)
+{
+	return (g_bp_bitmap[pc >> 5] >> (pc & 0x1F)) & 0x1;
+}
+
+int bp_add(u13_t pc);
+int bp_add_str(char *str);
+void bp_remove(u13_t pc);
+void bp_clear(void);
+uint32_t bp_get_num(void);
+bool_t bp_check(u13_t pc);
+
+int wp_add(u12_t start, u12_t end, u8_t type);
+int wp_add_str(char *str);
+void wp_remove(u12_t start, u12_t end, u8_t type);
+uint32_t wp_get_num(void);
+int wp_watch_add(u12_t start, u12_t end);
+bool_t wp_match(u12_t op);
+uint32_t wp_get_accesses(u8_t type, u12_t *addrs, u4_t *old_vals);
+void wp_report(u13_t pc, void (*log_func)(log_level_t level, char *buff, ...));
+
+#endif /* _BREAKPOINT_H_ */
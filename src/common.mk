@@ -1,8 +1,18 @@
 TARGET = tamatool
 
+# The sprite kernels rely on the compiler auto-vectorization
+OPT_FLAGS ?= -O2 -ftree-vectorize
+CFLAGS += $(OPT_FLAGS)
+
+# 64-bit timestamps (32-bit ones wrap every 71 minutes when expressed in us)
+TIMESTAMP_64 ?= 1
+ifeq ($(TIMESTAMP_64),1)
+CFLAGS += -DTIMESTAMP_64
+endif
+
 LIB_FOLDER = lib
 LIB_SRCS = $(LIB_FOLDER)/tamalib.c $(LIB_FOLDER)/cpu.c $(LIB_FOLDER)/hw.c
 
-SRCS = tamatool.c program.c image.c state.c mem_edit.c
+SRCS = tamatool.c program.c image.c state.c pet.c mem_edit.c watch.c shm_export.c trace.c async_log.c log_window.c input_script.c breakpoint.c gdb_stub.c fleet.c
 SRCS += $(LIB_SRCS)
 OBJECTS = $(SRCS:.c=.o)
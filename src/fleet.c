@@ -0,0 +1,223 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#if !defined(__WIN32__)
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "fleet.h"
+
+#define SAVE_EXTENSION					".bin"
+
+/* Shared between the workers, which are processes since TamaLIB only
+ * handles a single CPU
+ */
+typedef struct {
+	SDL_atomic_t next; // Index of the next pet to run, taken by the first idle worker
+	fleet_stats_t workers[FLEET_WORKER_MAX];
+} shared_t;
+
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void free_paths(char **paths, uint32_t num)
+{
+	uint32_t i;
+
+	for (i = 0; i < num; i++) {
+		SDL_free(paths[i]);
+	}
+
+	SDL_free(paths);
+}
+
+static int list_saves(char *dir, char ***list, uint32_t *num)
+{
+	DIR *d;
+	struct dirent *entry;
+	char **paths = NULL;
+	char **new_paths;
+	size_t len, ext_len = strlen(SAVE_EXTENSION);
+
+	*num = 0;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		fprintf(stderr, "FATAL: Cannot open directory \"%s\" !\n", dir);
+		return -1;
+	}
+
+	while ((entry = readdir(d)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len <= ext_len || strcmp(entry->d_name + len - ext_len, SAVE_EXTENSION)) {
+			continue;
+		}
+
+		new_paths = (char **) SDL_realloc(paths, (*num + 1) * sizeof(char *));
+		if (new_paths == NULL) {
+			break;
+		}
+		paths = new_paths;
+
+		paths[*num] = (char *) SDL_malloc(strlen(dir) + len + 2);
+		if (paths[*num] == NULL) {
+			break;
+		}
+
+		sprintf(paths[*num], "%s/%s", dir, entry->d_name);
+		(*num)++;
+	}
+
+	closedir(d);
+
+	if (entry != NULL) {
+		fprintf(stderr, "FATAL: Cannot allocate the list of pets !\n");
+		free_paths(paths, *num);
+		*num = 0;
+		return -1;
+	}
+
+	/* Same order whatever the file system */
+	if (*num > 0) {
+		qsort(paths, *num, sizeof(char *), &compare_paths);
+	}
+
+	*list = paths;
+
+	return 0;
+}
+
+static void worker(shared_t *shared, fleet_stats_t *stats, char **paths, uint32_t num, fleet_job_t job)
+{
+	int i;
+	uint64_t ticks;
+
+	while ((i = SDL_AtomicAdd(&shared->next, 1)) < (int) num) {
+		ticks = 0;
+		if (job(paths[i], &ticks) == 0) {
+			stats->pets++;
+		}
+
+		stats->ticks += ticks;
+	}
+}
+
+/* Runs every save found in dir, using the given number of workers */
+int fleet_run(char *dir, uint32_t workers, fleet_job_t job, fleet_stats_t *stats)
+{
+	shared_t *shared;
+	char **paths;
+	uint32_t num, started, i;
+	pid_t pid;
+
+	memset(stats, 0, sizeof(fleet_stats_t));
+
+	if (list_saves(dir, &paths, &num) < 0) {
+		return -1;
+	}
+
+	if (num == 0) {
+		fprintf(stderr, "FATAL: No \"*%s\" save found in \"%s\" !\n", SAVE_EXTENSION, dir);
+		free_paths(paths, num);
+		return -1;
+	}
+
+	shared = (shared_t *) mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		fprintf(stderr, "FATAL: Cannot allocate the shared fleet state !\n");
+		free_paths(paths, num);
+		return -1;
+	}
+
+	SDL_AtomicSet(&shared->next, 0);
+
+	if (workers > num) {
+		workers = num;
+	}
+
+	if (workers > FLEET_WORKER_MAX) {
+		workers = FLEET_WORKER_MAX;
+	}
+
+	/* Pending outputs would be written by every worker otherwise */
+	fflush(NULL);
+
+	for (started = 0; started < workers; started++) {
+		pid = fork();
+		if (pid == 0) {
+			worker(shared, &shared->workers[started], paths, num, job);
+			fflush(NULL);
+			_exit(EXIT_SUCCESS);
+		} else if (pid < 0) {
+			fprintf(stderr, "FATAL: Cannot start worker %u !\n", started);
+			break;
+		}
+	}
+
+	for (i = 0; i < started;) {
+		if (wait(NULL) >= 0) {
+			i++;
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		stats->pets += shared->workers[i].pets;
+		stats->ticks += shared->workers[i].ticks;
+	}
+
+	/* Including the ones a crashed worker did not get to */
+	stats->failed = num - stats->pets;
+
+	munmap(shared, sizeof(shared_t));
+	free_paths(paths, num);
+
+	return (started > 0) ? 0 : -1;
+}
+#else
+#include <stdio.h>
+#include <string.h>
+
+#include "lib/tamalib.h"
+
+#include "fleet.h"
+
+int fleet_run(char *dir, uint32_t workers, fleet_job_t job, fleet_stats_t *stats)
+{
+	memset(stats, 0, sizeof(fleet_stats_t));
+	fprintf(stderr, "FATAL: The fleet mode is not supported on this platform !\n");
+	return -1;
+}
+#endif
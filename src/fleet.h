@@ -0,0 +1,41 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _FLEET_H_
+#define _FLEET_H_
+
+#include <stdint.h>
+
+#include "lib/tamalib.h"
+
+#define FLEET_WORKER_MAX		256
+
+typedef struct {
+	uint32_t pets;
+	uint32_t failed;
+	uint64_t ticks; // Emulated ticks run by all the pets
+} fleet_stats_t;
+
+/* Runs a single pet, its emulated ticks being returned through ticks */
+typedef int (*fleet_job_t)(char *path, uint64_t *ticks);
+
+
+int fleet_run(char *dir, uint32_t workers, fleet_job_t job, fleet_stats_t *stats);
+
+#endif /* _FLEET_H_ */
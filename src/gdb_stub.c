@@ -0,0 +1,798 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#if !defined(__WIN32__)
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "lib/tamalib.h"
+
+#include "breakpoint.h"
+#include "gdb_stub.h"
+
+#define PACKET_SIZE					4096
+#define PACKET_DATA_MAX					(PACKET_SIZE - 16) // Advertised, leaves room for the $#xx framing and acks
+
+#define REG_NUM						8
+
+static int g_listen_fd = -1;
+static int g_client_fd = -1;
+
+static u12_t *g_program = NULL;
+static uint32_t g_program_size = 0;
+
+static char g_rx[PACKET_SIZE];
+static uint32_t g_rx_len = 0;
+
+static char g_socket_path[sizeof(((struct sockaddr_un *) 0)->sun_path)] = "";
+
+static bool_t g_stopped = 0;
+static bool_t g_stepping = 0;
+
+static const uint8_t reg_sizes[REG_NUM] = {2, 2, 2, 1, 1, 1, 1, 1};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Same layout as the g packet */
+static const char target_xml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target version=\"1.0\">"
+	"<feature name=\"org.tamatool.e0c6s46.core\">"
+	"<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\" regnum=\"0\"/>"
+	"<reg name=\"x\" bitsize=\"16\" type=\"data_ptr\"/>"
+	"<reg name=\"y\" bitsize=\"16\" type=\"data_ptr\"/>"
+	"<reg name=\"a\" bitsize=\"8\" type=\"uint8\"/>"
+	"<reg name=\"b\" bitsize=\"8\" type=\"uint8\"/>"
+	"<reg name=\"np\" bitsize=\"8\" type=\"uint8\"/>"
+	"<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+	"<reg name=\"flags\" bitsize=\"8\" type=\"uint8\"/>"
+	"</feature>"
+	"</target>";
+
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+static void send_raw(char *buf, uint32_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = send(g_client_fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void send_packet(char *data)
+{
+	char buf[PACKET_SIZE + 4];
+	uint32_t len = 0;
+	u8_t checksum = 0;
+
+	buf[len++] = '$';
+	for (; *data != '\0' && len < PACKET_SIZE; data++) {
+		buf[len++] = *data;
+		checksum += *data;
+	}
+	buf[len++] = '#';
+	buf[len++] = hex_digits[checksum >> 4];
+	buf[len++] = hex_digits[checksum & 0xF];
+
+	send_raw(buf, len);
+}
+
+static void send_stop(int sig)
+{
+	char buf[4];
+
+	snprintf(buf, sizeof(buf), "S%02x", sig);
+	send_packet(buf);
+}
+
+static u32_t get_reg(uint32_t n)
+{
+	state_t *state = tamalib_get_state();
+
+	switch (n) {
+		case 0: return *(state->pc);
+		case 1: return *(state->x);
+		case 2: return *(state->y);
+		case 3: return *(state->a);
+		case 4: return *(state->b);
+		case 5: return *(state->np);
+		case 6: return *(state->sp);
+		case 7: return *(state->flags);
+	}
+
+	return 0;
+}
+
+static void set_reg(uint32_t n, u32_t v)
+{
+	state_t *state = tamalib_get_state();
+
+	switch (n) {
+		case 0: *(state->pc) = v & 0x1FFF; break;
+		case 1: *(state->x) = v & 0xFFF; break;
+		case 2: *(state->y) = v & 0xFFF; break;
+		case 3: *(state->a) = v & 0xF; break;
+		case 4: *(state->b) = v & 0xF; break;
+		case 5: *(state->np) = v & 0x1F; break;
+		case 6: *(state->sp) = v & 0xFF; break;
+		case 7: *(state->flags) = v & 0xF; break;
+	}
+}
+
+/* Little-endian hex, returns the number of characters written */
+static uint32_t put_reg(char *buf, uint32_t n)
+{
+	u32_t v = get_reg(n);
+	uint32_t i;
+
+	for (i = 0; i < reg_sizes[n]; i++, v >>= 8) {
+		buf[2 * i] = hex_digits[(v >> 4) & 0xF];
+		buf[2 * i + 1] = hex_digits[v & 0xF];
+	}
+
+	return 2 * reg_sizes[n];
+}
+
+/* Little-endian hex, returns the number of characters read or -1 */
+static int parse_reg(char *buf, uint32_t n, u32_t *v)
+{
+	uint32_t i;
+	int h, l;
+
+	*v = 0;
+	for (i = 0; i < reg_sizes[n]; i++) {
+		h = hex_value(buf[2 * i]);
+		l = (h < 0) ? -1 : hex_value(buf[2 * i + 1]);
+		if (l < 0) {
+			return -1;
+		}
+
+		*v |= (u32_t) ((h << 4) | l) << (8 * i);
+	}
+
+	return 2 * reg_sizes[n];
+}
+
+static int read_byte(u32_t addr, u8_t *v)
+{
+	state_t *state = tamalib_get_state();
+	u32_t word;
+
+	if (addr < MEMORY_SIZE) {
+		*v = GET_MEMORY(state->memory, addr);
+		return 0;
+	}
+
+	if (addr >= GDB_PROGRAM_BASE && addr - GDB_PROGRAM_BASE < g_program_size * 2) {
+		word = g_program[(addr - GDB_PROGRAM_BASE) / 2];
+		*v = (addr & 0x1) ? (word >> 8) : (word & 0xFF);
+		return 0;
+	}
+
+	return -1;
+}
+
+static void handle_read_memory(char *args)
+{
+	char buf[PACKET_SIZE];
+	char *end;
+	u32_t addr, len, i;
+	u8_t v;
+
+	/* m<addr>,<len> */
+	addr = strtoul(args, &end, 16);
+	if (*end != ',') {
+		send_packet("E01");
+		return;
+	}
+
+	len = strtoul(end + 1, NULL, 16);
+	if (len > PACKET_DATA_MAX / 2) {
+		len = PACKET_DATA_MAX / 2;
+	}
+
+	for (i = 0; i < len && !read_byte(addr + i, &v); i++) {
+		buf[2 * i] = hex_digits[v >> 4];
+		buf[2 * i + 1] = hex_digits[v & 0xF];
+	}
+
+	if (i == 0 && len > 0) {
+		send_packet("E01");
+		return;
+	}
+
+	buf[2 * i] = '\0';
+	send_packet(buf);
+}
+
+static void handle_write_memory(char *args)
+{
+	state_t *state = tamalib_get_state();
+	char *end;
+	u32_t addr, len, i;
+	int h, l;
+
+	/* M<addr>,<len>:<data> (the data memory only) */
+	addr = strtoul(args, &end, 16);
+	if (*end != ',') {
+		send_packet("E01");
+		return;
+	}
+
+	len = strtoul(end + 1, &end, 16);
+	if (*end != ':' || addr >= MEMORY_SIZE || len > MEMORY_SIZE - addr || strlen(end + 1) < 2 * len) {
+		send_packet("E01");
+		return;
+	}
+
+	for (i = 0, end++; i < len; i++) {
+		h = hex_value(end[2 * i]);
+		l = hex_value(end[2 * i + 1]);
+		if (h < 0 || l < 0) {
+			send_packet("E01");
+			return;
+		}
+
+		SET_MEMORY(state->memory, addr + i, l);
+	}
+
+	send_packet("OK");
+}
+
+static void handle_registers(char *args, bool_t write)
+{
+	char buf[64];
+	uint32_t len = 0, n;
+	u32_t v;
+	int ret;
+
+	if (!write) {
+		for (n = 0; n < REG_NUM; n++) {
+			len += put_reg(&buf[len], n);
+		}
+
+		buf[len] = '\0';
+		send_packet(buf);
+		return;
+	}
+
+	for (n = 0; n < REG_NUM; n++) {
+		ret = parse_reg(args, n, &v);
+		if (ret < 0) {
+			send_packet("E01");
+			return;
+		}
+
+		set_reg(n, v);
+		args += ret;
+	}
+
+	send_packet("OK");
+}
+
+static void handle_register(char *args, bool_t write)
+{
+	char buf[8];
+	char *end;
+	uint32_t n;
+	u32_t v;
+
+	/* p<n> or P<n>=<value> */
+	n = strtoul(args, &end, 16);
+	if (n >= REG_NUM || (write && *end != '=')) {
+		send_packet("E01");
+		return;
+	}
+
+	if (!write) {
+		buf[put_reg(buf, n)] = '\0';
+		send_packet(buf);
+		return;
+	}
+
+	if (parse_reg(end + 1, n, &v) < 0) {
+		send_packet("E01");
+		return;
+	}
+
+	set_reg(n, v);
+	send_packet("OK");
+}
+
+static void handle_breakpoint(char *args, bool_t insert)
+{
+	char *end;
+	u32_t type, addr, len;
+
+	/* Z<type>,<addr>,<kind/len> or z<type>,<addr>,<kind/len> */
+	type = strtoul(args, &end, 16);
+	if (*end != ',') {
+		send_packet("E01");
+		return;
+	}
+
+	addr = strtoul(end + 1, &end, 16);
+	if (*end != ',') {
+		send_packet("E01");
+		return;
+	}
+
+	len = strtoul(end + 1, NULL, 16);
+
+	switch (type) {
+		case 0: // Software
+		case 1: // Hardware
+			if (addr >= BP_PC_NUM) {
+				send_packet("E01");
+				return;
+			}
+
+			if (insert) {
+				bp_add(addr);
+			} else {
+				bp_remove(addr);
+			}
+			break;
+
+		case 2: // Write
+		case 3: // Read
+		case 4: // Access
+			if (len == 0 || addr >= MEMORY_SIZE || len > MEMORY_SIZE - addr) {
+				send_packet("E01");
+				return;
+			}
+
+			type = (type == 2) ? WP_WRITE : ((type == 3) ? WP_READ : (WP_READ | WP_WRITE));
+			if (insert) {
+				if (wp_add(addr, addr + len - 1, type) < 0) {
+					send_packet("E01");
+					return;
+				}
+			} else {
+				wp_remove(addr, addr + len - 1, type);
+			}
+			break;
+
+		default:
+			send_packet("");
+			return;
+	}
+
+	send_packet("OK");
+}
+
+static void handle_xfer(char *args)
+{
+	char buf[PACKET_SIZE];
+	char *end;
+	u32_t offset, len, total = sizeof(target_xml) - 1;
+
+	/* Xfer:features:read:target.xml:<offset>,<length> */
+	if (strncmp(args, "Xfer:features:read:target.xml:", 30)) {
+		send_packet("");
+		return;
+	}
+
+	offset = strtoul(args + 30, &end, 16);
+	if (*end != ',' || offset > total) {
+		send_packet("E01");
+		return;
+	}
+
+	len = strtoul(end + 1, NULL, 16);
+	if (len > total - offset) {
+		len = total - offset;
+	}
+
+	if (len > PACKET_DATA_MAX - 1) {
+		len = PACKET_DATA_MAX - 1;
+	}
+
+	/* The XML does not contain any character to escape */
+	buf[0] = (offset + len < total) ? 'm' : 'l';
+	memcpy(&buf[1], &target_xml[offset], len);
+	buf[len + 1] = '\0';
+	send_packet(buf);
+}
+
+static void resume(char *args, bool_t step)
+{
+	/* c[addr] or s[addr] */
+	if (*args != '\0') {
+		set_reg(0, strtoul(args, NULL, 16));
+	}
+
+	g_stopped = 0;
+	g_stepping = step;
+	tamalib_set_exec_mode(step ? EXEC_MODE_STEP : EXEC_MODE_RUN);
+}
+
+static void stop(void)
+{
+	tamalib_set_exec_mode(EXEC_MODE_PAUSE);
+	g_stopped = 1;
+	g_stepping = 0;
+}
+
+static void close_client(void)
+{
+	close(g_client_fd);
+	g_client_fd = -1;
+
+	/* The emulation goes on without the debugger */
+	g_stopped = 0;
+	g_stepping = 0;
+	tamalib_set_exec_mode(EXEC_MODE_RUN);
+}
+
+static void handle_packet(char *packet)
+{
+	char *args = packet + 1;
+	char buf[64];
+
+	switch (packet[0]) {
+		case '?':
+			send_stop(SIGTRAP);
+			break;
+
+		case 'g':
+			handle_registers(args, 0);
+			break;
+
+		case 'G':
+			handle_registers(args, 1);
+			break;
+
+		case 'p':
+			handle_register(args, 0);
+			break;
+
+		case 'P':
+			handle_register(args, 1);
+			break;
+
+		case 'm':
+			handle_read_memory(args);
+			break;
+
+		case 'M':
+			handle_write_memory(args);
+			break;
+
+		case 'Z':
+			handle_breakpoint(args, 1);
+			break;
+
+		case 'z':
+			handle_breakpoint(args, 0);
+			break;
+
+		case 'c':
+			resume(args, 0);
+			break;
+
+		case 's':
+			resume(args, 1);
+			break;
+
+		case 'H':
+			send_packet("OK");
+			break;
+
+		case 'q':
+			if (!strncmp(args, "Supported", 9)) {
+				snprintf(buf, sizeof(buf), "PacketSize=%x;qXfer:features:read+", PACKET_DATA_MAX);
+				send_packet(buf);
+			} else if (!strncmp(args, "Xfer:", 5)) {
+				handle_xfer(args);
+			} else if (!strcmp(args, "Attached")) {
+				send_packet("1");
+			} else {
+				send_packet("");
+			}
+			break;
+
+		case 'D':
+			send_packet("OK");
+			close_client();
+			break;
+
+		case 'k':
+			close_client();
+			break;
+
+		default:
+			send_packet("");
+			break;
+	}
+}
+
+/* Handles every complete packet of the receive buffer */
+static void process_rx(void)
+{
+	char *start, *end;
+	uint32_t i, consumed = 0;
+	u8_t checksum;
+
+	while (consumed < g_rx_len && g_client_fd >= 0) {
+		start = &g_rx[consumed];
+
+		if (*start == 0x03) {
+			/* Interrupt request */
+			consumed++;
+			if (!g_stopped) {
+				stop();
+				send_stop(SIGINT);
+			}
+			continue;
+		}
+
+		if (*start != '$') {
+			/* Acks and garbage */
+			consumed++;
+			continue;
+		}
+
+		end = memchr(start, '#', g_rx_len - consumed);
+		if (end == NULL || end + 2 >= &g_rx[g_rx_len]) {
+			/* Incomplete */
+			break;
+		}
+
+		for (i = 1, checksum = 0; &start[i] < end; i++) {
+			checksum += start[i];
+		}
+
+		consumed = end + 3 - g_rx;
+
+		if (hex_value(end[1]) != (checksum >> 4) || hex_value(end[2]) != (checksum & 0xF)) {
+			send_raw("-", 1);
+			continue;
+		}
+
+		send_raw("+", 1);
+
+		*end = '\0';
+		handle_packet(start + 1);
+	}
+
+	if (g_client_fd < 0) {
+		g_rx_len = 0;
+		return;
+	}
+
+	if (consumed == 0 && g_rx_len == PACKET_SIZE) {
+		/* Too long to be handled */
+		consumed = g_rx_len;
+	}
+
+	memmove(g_rx, &g_rx[consumed], g_rx_len - consumed);
+	g_rx_len -= consumed;
+}
+
+int gdb_stub_open(char *addr, u12_t *program, uint32_t program_size)
+{
+	struct sockaddr_in in_addr;
+	struct sockaddr_un un_addr;
+	struct stat st;
+	char *end;
+	unsigned long port;
+	int one = 1;
+
+	g_program = program;
+	g_program_size = program_size;
+
+	/* A port number (localhost only) or a Unix socket path */
+	port = strtoul(addr, &end, 10);
+	if (end != addr && *end == '\0') {
+		if (port == 0 || port > 65535) {
+			fprintf(stderr, "FATAL: Invalid GDB port %s !\n", addr);
+			return -1;
+		}
+
+		g_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (g_listen_fd < 0) {
+			fprintf(stderr, "FATAL: Cannot create the GDB socket !\n");
+			return -1;
+		}
+
+		setsockopt(g_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		memset(&in_addr, 0, sizeof(in_addr));
+		in_addr.sin_family = AF_INET;
+		in_addr.sin_port = htons(port);
+		in_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(g_listen_fd, (struct sockaddr *) &in_addr, sizeof(in_addr)) < 0) {
+			fprintf(stderr, "FATAL: Cannot bind the GDB socket to port %lu !\n", port);
+			close(g_listen_fd);
+			g_listen_fd = -1;
+			return -1;
+		}
+	} else {
+		if (strlen(addr) >= sizeof(un_addr.sun_path)) {
+			fprintf(stderr, "FATAL: GDB socket path \"%s\" is too long !\n", addr);
+			return -1;
+		}
+
+		g_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (g_listen_fd < 0) {
+			fprintf(stderr, "FATAL: Cannot create the GDB socket !\n");
+			return -1;
+		}
+
+		memset(&un_addr, 0, sizeof(un_addr));
+		un_addr.sun_family = AF_UNIX;
+		strcpy(un_addr.sun_path, addr);
+
+		/* Only a socket left by a previous run is replaced */
+		if (lstat(addr, &st) == 0 && S_ISSOCK(st.st_mode)) {
+			unlink(addr);
+		}
+
+		if (bind(g_listen_fd, (struct sockaddr *) &un_addr, sizeof(un_addr)) < 0) {
+			fprintf(stderr, "FATAL: Cannot bind the GDB socket to \"%s\" !\n", addr);
+			close(g_listen_fd);
+			g_listen_fd = -1;
+			return -1;
+		}
+
+		/* Removed when closing */
+		strcpy(g_socket_path, addr);
+	}
+
+	/* Polled from the main loop */
+	fcntl(g_listen_fd, F_SETFL, fcntl(g_listen_fd, F_GETFL) | O_NONBLOCK);
+
+	if (listen(g_listen_fd, 1) < 0) {
+		fprintf(stderr, "FATAL: Cannot listen on the GDB socket !\n");
+		gdb_stub_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void gdb_stub_poll(void)
+{
+	ssize_t ret;
+	int one = 1;
+
+	if (g_listen_fd < 0) {
+		return;
+	}
+
+	if (g_client_fd < 0) {
+		g_client_fd = accept(g_listen_fd, NULL, NULL);
+		if (g_client_fd < 0) {
+			return;
+		}
+
+		setsockopt(g_client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		/* GDB expects the target to be stopped when attaching */
+		stop();
+		g_rx_len = 0;
+	}
+
+	ret = recv(g_client_fd, &g_rx[g_rx_len], PACKET_SIZE - g_rx_len, MSG_DONTWAIT);
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		close_client();
+		return;
+	}
+
+	if (ret > 0) {
+		g_rx_len += ret;
+		process_rx();
+	}
+}
+
+bool_t gdb_stub_is_stopped(void)
+{
+	return g_stopped;
+}
+
+bool_t gdb_stub_is_stepping(void)
+{
+	return g_stepping;
+}
+
+/* Called when the execution stopped (breakpoint, watchpoint or step) */
+void gdb_stub_notify_stop(void)
+{
+	if (g_client_fd < 0 || g_stopped) {
+		return;
+	}
+
+	stop();
+	send_stop(SIGTRAP);
+}
+
+void gdb_stub_close(void)
+{
+	if (g_client_fd >= 0) {
+		close(g_client_fd);
+		g_client_fd = -1;
+	}
+
+	if (g_listen_fd >= 0) {
+		close(g_listen_fd);
+		g_listen_fd = -1;
+	}
+
+	if (g_socket_path[0]) {
+		unlink(g_socket_path);
+		g_socket_path[0] = '\0';
+	}
+}
+#else
+#include <stdio.h>
+
+#include "lib/tamalib.h"
+
+#include "gdb_stub.h"
+
+int gdb_stub_open(char *addr, u12_t *program, uint32_t program_size)
+{
+	fprintf(stderr, "FATAL: The GDB stub is not supported on this platform !\n");
+	return -1;
+}
+
+void gdb_stub_poll(void) {}
+bool_t gdb_stub_is_stopped(void) { return 0; }
+bool_t gdb_stub_is_stepping(void) { return 0; }
+void gdb_stub_notify_stop(void) {}
+void gdb_stub_close(void) {}
+#endif
@@ -0,0 +1,42 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _GDB_STUB_H_
+#define _GDB_STUB_H_
+
+#include "lib/tamalib.h"
+
+/* Register numbers used by the g/G/p/P packets (little-endian):
+ * 0: PC (2 bytes), 1: X (2 bytes), 2: Y (2 bytes), 3: A, 4: B, 5: NP, 6: SP, 7: F
+ *
+ * Addresses below 0x1000 are the data memory (one nibble per byte), addresses
+ * starting at GDB_PROGRAM_BASE are the program (one 12-bit word every two
+ * bytes, read-only).
+ */
+#define GDB_PROGRAM_BASE		0x10000
+
+
+int gdb_stub_open(char *addr, u12_t *program, uint32_t program_size);
+void gdb_stub_poll(void);
+bool_t gdb_stub_is_stopped(void);
+bool_t gdb_stub_is_stepping(void);
+void gdb_stub_notify_stop(void);
+void gdb_stub_close(void);
+
+#endif /* _GDB_STUB_H_ */
@@ -29,6 +29,12 @@ typedef uint8_t u8_t;
 typedef uint16_t u12_t;
 typedef uint16_t u13_t;
 typedef uint32_t u32_t;
+#ifdef TIMESTAMP_64
+typedef uint64_t timestamp_t; // Never wraps in practice
+typedef int64_t timestamp_diff_t;
+#else
 typedef uint32_t timestamp_t; // WARNING: Must be an unsigned type to properly handle wrapping (u32 wraps in around 1h11m when expressed in us)
+typedef int32_t timestamp_diff_t;
+#endif
 
 #endif /* _HAL_TYPES_H_ */
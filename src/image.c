@@ -29,24 +29,55 @@
 #include "image.h"
 
 
-void image_alloc(image_t *image)
+#define ALIGN_UP(v)			(((v) + IMAGE_ALIGNMENT - 1) & ~((size_t) IMAGE_ALIGNMENT - 1))
+
+
+static int image_pitch(image_t *image)
+{
+	return ALIGN_UP(image->stride);
+}
+
+static size_t image_buffer_size(image_t *image)
+{
+	/* Row pointers, then the rows, plus some room to align them */
+	return sizeof(png_bytep) * image->height + (IMAGE_ALIGNMENT - 1) + (size_t) image_pitch(image) * image->height;
+}
+
+static void image_setup(image_t *image, void *buffer)
 {
 	unsigned int y;
 
-	image->row_pointers = (png_bytepp) SDL_calloc(sizeof(png_bytep) * image->height, 1);
+	image->pitch = image_pitch(image);
+	image->row_pointers = (png_bytepp) buffer;
+	image->pixels = (png_bytep) ALIGN_UP((uintptr_t) (image->row_pointers + image->height));
+
+	SDL_memset(image->pixels, 0, (size_t) image->pitch * image->height);
+
 	for (y = 0; y < image->height; y++) {
-		image->row_pointers[y] = (png_byte*) SDL_calloc(image->stride, 1);
+		image->row_pointers[y] = image->pixels + (size_t) y * image->pitch;
 	}
 }
 
+void image_alloc(image_t *image)
+{
+	image->buffer = SDL_malloc(image_buffer_size(image));
+	if (image->buffer == NULL) {
+		fprintf(stderr, "[image_alloc] Cannot allocate %dx%d image", image->width, image->height);
+		image->row_pointers = NULL;
+		image->pixels = NULL;
+		return;
+	}
+
+	image_setup(image, image->buffer);
+}
+
 void image_free(image_t *image)
 {
-	unsigned int y;
+	SDL_free(image->buffer);
 
-	for (y = 0; y < image->height; y++) {
-		SDL_free(image->row_pointers[y]);
-	}
-	SDL_free(image->row_pointers);
+	image->buffer = NULL;
+	image->row_pointers = NULL;
+	image->pixels = NULL;
 }
 
 void image_read_file(char* file_name, image_t *image)
@@ -56,6 +87,11 @@ void image_read_file(char* file_name, image_t *image)
 	png_infop info_ptr;
 
 	FILE *fp = fopen(file_name, "rb");
+
+	image->buffer = NULL;
+	image->row_pointers = NULL;
+	image->pixels = NULL;
+
 	if (!fp) {
 		fprintf(stderr, "[read_png_file] File %s could not be opened for reading", file_name);
 		return;
@@ -94,29 +130,64 @@ void image_read_file(char* file_name, image_t *image)
 
 	png_read_info(png_ptr, info_ptr);
 
+	/* Whatever the format of the file (palette, grayscale, low bit depth),
+	 * the image is always read as 8-bit RGBA
+	 */
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	if (!(png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_ALPHA) &&
+		!png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+		png_set_add_alpha(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	}
+
+	png_read_update_info(png_ptr, info_ptr);
+
 	image->width = png_get_image_width(png_ptr, info_ptr);
 	image->height = png_get_image_height(png_ptr, info_ptr);
 	image->color_type = png_get_color_type(png_ptr, info_ptr);
 	image->bit_depth = png_get_bit_depth(png_ptr, info_ptr);
 	image->stride = png_get_rowbytes(png_ptr,info_ptr);
 
-	png_read_update_info(png_ptr, info_ptr);
-
 	/* read file */
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		fprintf(stderr, "[read_png_file] Error during read_image");
+		image_free(image);
 		fclose(fp);
 		return;
 	}
 
 	image_alloc(image);
+	if (image->row_pointers == NULL) {
+		fclose(fp);
+		return;
+	}
 
 	png_read_image(png_ptr, image->row_pointers);
 
 	fclose(fp);
 }
 
-void image_write_file(char* file_name, image_t *image)
+int image_filters_from_str(char *str)
+{
+	if (!strcmp(str, "none")) {
+		return PNG_FILTER_NONE;
+	} else if (!strcmp(str, "sub")) {
+		return PNG_FILTER_SUB;
+	} else if (!strcmp(str, "up")) {
+		return PNG_FILTER_UP;
+	} else if (!strcmp(str, "avg")) {
+		return PNG_FILTER_AVG;
+	} else if (!strcmp(str, "paeth")) {
+		return PNG_FILTER_PAETH;
+	} else if (!strcmp(str, "all")) {
+		return PNG_ALL_FILTERS;
+	}
+
+	return IMAGE_DEFAULT;
+}
+
+void image_write_file(char* file_name, image_t *image, int compression_level, int filters)
 {
 	png_structp png_ptr;
 	png_infop info_ptr;
@@ -160,8 +231,29 @@ void image_write_file(char* file_name, image_t *image)
 		image->bit_depth, image->color_type, PNG_INTERLACE_NONE,
 		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
+	if (image->color_type == PNG_COLOR_TYPE_PALETTE) {
+		png_set_PLTE(png_ptr, info_ptr, image->palette, image->num_palette);
+
+		if (image->num_trans > 0) {
+			png_set_tRNS(png_ptr, info_ptr, image->trans, image->num_trans, NULL);
+		}
+	}
+
+	if (compression_level != IMAGE_DEFAULT) {
+		png_set_compression_level(png_ptr, compression_level);
+	}
+
+	if (filters != IMAGE_DEFAULT) {
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
+	}
+
 	png_write_info(png_ptr, info_ptr);
 
+	/* Rows of low bit depth images hold one pixel per byte */
+	if (image->bit_depth < 8) {
+		png_set_packing(png_ptr);
+	}
+
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		fprintf(stderr, "[write_png_file] Error during writing bytes");
 		fclose(fp);
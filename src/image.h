@@ -22,6 +22,10 @@
 
 #include <png.h>
 
+#define IMAGE_ALIGNMENT			16
+
+#define IMAGE_DEFAULT			-1 // Default compression level/filters
+
 typedef struct {
 	int width;
 	int height;
@@ -29,13 +33,26 @@ typedef struct {
 	png_byte color_type;
 	png_byte bit_depth;
 
+	/* Palette images only (written with one pixel per byte) */
+	png_colorp palette;
+	int num_palette;
+	png_bytep trans;
+	int num_trans;
+
 	png_bytepp row_pointers;
+
+	/* Rows are stored contiguously, each one starting at an aligned address */
+	png_bytep pixels;
+	int pitch;
+
+	void *buffer; // Single allocated block, holding the row pointers and the rows
 } image_t;
 
 
 void image_alloc(image_t *image);
 void image_free(image_t *image);
 void image_read_file(char* file_name, image_t *image);
-void image_write_file(char* file_name, image_t *image);
+int image_filters_from_str(char *str);
+void image_write_file(char* file_name, image_t *image, int compression_level, int filters);
 
 #endif /* _IMAGE_H_ */
@@ -0,0 +1,200 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "input_script.h"
+
+#define LINE_MAX_LEN					128
+#define EVENTS_ALLOC_STEP				256
+
+typedef struct {
+	uint64_t tick;
+	button_t btn;
+	btn_state_t state;
+} input_event_t;
+
+static const char *btn_names[] = {
+	[BTN_LEFT] = "left",
+	[BTN_MIDDLE] = "middle",
+	[BTN_RIGHT] = "right",
+	[BTN_TAP] = "tap",
+};
+
+static const char *state_names[] = {
+	[BTN_STATE_RELEASED] = "release",
+	[BTN_STATE_PRESSED] = "press",
+};
+
+static FILE *g_record_fp = NULL;
+
+static input_event_t *g_events = NULL;
+static uint32_t g_num = 0;
+static uint32_t g_next = 0;
+
+
+static int find_name(const char **names, uint32_t num, char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < num; i++) {
+		if (!strcmp(names[i], name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int input_script_record_open(char *path)
+{
+	g_record_fp = fopen(path, "w");
+	if (g_record_fp == NULL) {
+		fprintf(stderr, "FATAL: Cannot create input script \"%s\" !\n", path);
+		return -1;
+	}
+
+	fprintf(g_record_fp, "# <tick> <button> <state>\n");
+
+	return 0;
+}
+
+void input_script_record(uint64_t tick, button_t btn, btn_state_t state)
+{
+	if (g_record_fp == NULL) {
+		return;
+	}
+
+	fprintf(g_record_fp, "%" PRIu64 " %s %s\n", tick, btn_names[btn], state_names[state]);
+}
+
+static int add_event(uint64_t tick, button_t btn, btn_state_t state)
+{
+	input_event_t *events;
+
+	if (g_num % EVENTS_ALLOC_STEP == 0) {
+		events = (input_event_t *) SDL_realloc(g_events, (g_num + EVENTS_ALLOC_STEP) * sizeof(input_event_t));
+		if (events == NULL) {
+			return -1;
+		}
+
+		g_events = events;
+	}
+
+	g_events[g_num].tick = tick;
+	g_events[g_num].btn = btn;
+	g_events[g_num].state = state;
+	g_num++;
+
+	return 0;
+}
+
+int input_script_play_open(char *path)
+{
+	FILE *f;
+	char line[LINE_MAX_LEN];
+	char btn_str[16], state_str[16];
+	unsigned long long tick;
+	uint64_t last_tick = 0;
+	uint32_t n = 0;
+	char *p;
+	int btn, state;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "FATAL: Cannot open input script \"%s\" !\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n++;
+
+		p = line + strspn(line, " \t\r\n");
+		if (*p == '\0' || *p == '#') {
+			/* Empty line or comment */
+			continue;
+		}
+
+		if (sscanf(p, "%llu %15s %15s", &tick, btn_str, state_str) != 3 ||
+			(btn = find_name(btn_names, sizeof(btn_names)/sizeof(btn_names[0]), btn_str)) < 0 ||
+			(state = find_name(state_names, sizeof(state_names)/sizeof(state_names[0]), state_str)) < 0 ||
+			tick < last_tick) {
+			fprintf(stderr, "FATAL: Invalid event at line %u of input script \"%s\" !\n", n, path);
+			goto error;
+		}
+
+		if (add_event(tick, (button_t) btn, (btn_state_t) state) < 0) {
+			fprintf(stderr, "FATAL: Cannot allocate the input events !\n");
+			goto error;
+		}
+
+		last_tick = tick;
+	}
+
+	fclose(f);
+	g_next = 0;
+
+	return 0;
+
+error:
+	fclose(f);
+	SDL_free(g_events);
+	g_events = NULL;
+	g_num = 0;
+
+	return -1;
+}
+
+/* Injects the events that are due, tick being the current emulated time */
+void input_script_play(uint64_t tick)
+{
+	input_event_t *e;
+
+	while (g_next < g_num && g_events[g_next].tick <= tick) {
+		e = &g_events[g_next++];
+
+		tamalib_set_button(e->btn, e->state);
+
+		/* Keep the played events when recording, so that the live
+		 * input can be appended to a script
+		 */
+		input_script_record(tick, e->btn, e->state);
+	}
+}
+
+void input_script_close(void)
+{
+	if (g_record_fp != NULL) {
+		fclose(g_record_fp);
+		g_record_fp = NULL;
+	}
+
+	SDL_free(g_events);
+	g_events = NULL;
+	g_num = 0;
+	g_next = 0;
+}
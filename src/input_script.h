@@ -0,0 +1,39 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _INPUT_SCRIPT_H_
+#define _INPUT_SCRIPT_H_
+
+#include <stdint.h>
+
+#include "lib/tamalib.h"
+
+/* Text format, one event per line:
+ *   <tick> <left|middle|right|tap> <press|release>
+ * <tick> being the number of emulated ticks (32768 Hz) since the start.
+ * Empty lines and lines starting with # are ignored.
+ */
+
+int input_script_record_open(char *path);
+void input_script_record(uint64_t tick, button_t btn, btn_state_t state);
+int input_script_play_open(char *path);
+void input_script_play(uint64_t tick);
+void input_script_close(void);
+
+#endif /* _INPUT_SCRIPT_H_ */
@@ -0,0 +1,187 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lib/tamalib.h"
+
+#include "log_window.h"
+
+#define PC_NUM						(1 << 13)
+
+typedef struct {
+	log_trigger_type_t type;
+	u32_t hits;
+	u32_t min_hits;
+} trigger_t;
+
+/* Trigger index + 1 for each PC, so that an address without any trigger
+ * costs a single lookup
+ */
+static u8_t g_pc_triggers[PC_NUM] = {0};
+static trigger_t g_triggers[LOG_TRIGGER_MAX];
+static uint32_t g_num = 0;
+static uint32_t g_num_start = 0;
+
+typedef enum {
+	TICKS_DISABLED = 0,
+	TICKS_WAIT_START,
+	TICKS_WAIT_STOP,
+} ticks_state_t;
+
+static ticks_state_t g_ticks_state = TICKS_DISABLED;
+static u32_t g_start_tick = 0;
+static u32_t g_stop_tick = 0;
+
+static bool_t g_open = 0;
+
+
+/* Without anything to open it, the window starts open so that stop
+ * triggers alone still log until they are hit
+ */
+static void update_initial_state(void)
+{
+	g_open = (g_num_start == 0 && g_ticks_state == TICKS_DISABLED);
+}
+
+int log_window_add_trigger_str(log_trigger_type_t type, char *str)
+{
+	char *end;
+	unsigned long pc, hits = 1;
+
+	/* <pc> or <pc>:<hits> */
+	pc = strtoul(str, &end, 0);
+	if (end == str) {
+		return -1;
+	}
+
+	if (*end == ':') {
+		str = end + 1;
+		hits = strtoul(str, &end, 0);
+		if (end == str || hits == 0) {
+			return -1;
+		}
+	}
+
+	if (*end != '\0' || pc >= PC_NUM || g_pc_triggers[pc] || g_num >= LOG_TRIGGER_MAX) {
+		return -1;
+	}
+
+	g_triggers[g_num].type = type;
+	g_triggers[g_num].hits = 0;
+	g_triggers[g_num].min_hits = hits;
+	g_pc_triggers[pc] = ++g_num;
+
+	if (type == LOG_TRIGGER_START) {
+		g_num_start++;
+	}
+
+	update_initial_state();
+
+	return 0;
+}
+
+int log_window_set_ticks_str(char *str)
+{
+	char *end;
+	unsigned long start, stop = UINT32_MAX;
+
+	/* <tick> or <tick>-<tick> */
+	start = strtoul(str, &end, 0);
+	if (end == str) {
+		return -1;
+	}
+
+	if (*end == '-') {
+		str = end + 1;
+		stop = strtoul(str, &end, 0);
+		if (end == str) {
+			return -1;
+		}
+	}
+
+	if (*end != '\0' || start >= stop) {
+		return -1;
+	}
+
+	g_ticks_state = TICKS_WAIT_START;
+	g_start_tick = start;
+	g_stop_tick = stop;
+
+	update_initial_state();
+
+	return 0;
+}
+
+/* Must be called before executing the instruction at pc. A trigger
+ * found there only applies to this call, its hit being counted once the
+ * instruction is known to have been executed.
+ */
+bool_t log_window_check(u13_t pc, u32_t tick)
+{
+	trigger_t *t;
+
+	/* The tick range opens and closes the window once, PC triggers
+	 * can still act in the meantime
+	 */
+	if (g_ticks_state == TICKS_WAIT_START && tick >= g_start_tick) {
+		g_open = 1;
+		g_ticks_state = TICKS_WAIT_STOP;
+	}
+
+	if (g_ticks_state == TICKS_WAIT_STOP && tick >= g_stop_tick) {
+		g_open = 0;
+		g_ticks_state = TICKS_DISABLED;
+	}
+
+	if (g_pc_triggers[pc]) {
+		t = &g_triggers[g_pc_triggers[pc] - 1];
+
+		/* min_hits is never 0 */
+		if (t->hits >= t->min_hits - 1) {
+			return (t->type == LOG_TRIGGER_START);
+		}
+	}
+
+	return g_open;
+}
+
+/* Must be called after actually executing the instruction at pc, neither
+ * paused nor halted iterations counting as hits
+ */
+void log_window_executed(u13_t pc)
+{
+	trigger_t *t;
+
+	if (!g_pc_triggers[pc]) {
+		return;
+	}
+
+	t = &g_triggers[g_pc_triggers[pc] - 1];
+
+	if (t->hits < t->min_hits) {
+		t->hits++;
+	}
+
+	if (t->hits >= t->min_hits) {
+		g_open = (t->type == LOG_TRIGGER_START);
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _LOG_WINDOW_H_
+#define _LOG_WINDOW_H_
+
+#include "lib/tamalib.h"
+
+#define LOG_TRIGGER_MAX			32
+
+typedef enum {
+	LOG_TRIGGER_START = 0,
+	LOG_TRIGGER_STOP,
+} log_trigger_type_t;
+
+
+int log_window_add_trigger_str(log_trigger_type_t type, char *str);
+int log_window_set_ticks_str(char *str);
+bool_t log_window_check(u13_t pc, u32_t tick);
+void log_window_executed(u13_t pc);
+
+#endif /* _LOG_WINDOW_H_ */
@@ -22,17 +22,43 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <sys/select.h>
 #include <termios.h>
 
 #include "lib/tamalib.h"
 
+#include "watch.h"
 #include "mem_edit.h"
 
+#define OUT_BUFFER_SIZE				65536
+
+/* Layout (1-based terminal rows/columns) */
+#define MEM_LINE_SIZE				0x80
+#define MEM_ROW					2
+#define MEM_COLUMN				8 // After "0xXXX: "
+#define VARIABLES_ROW				(MEM_ROW + MEMORY_SIZE/MEM_LINE_SIZE + 1)
+#define CURSOR_ROW				(VARIABLES_ROW + 2)
+#define WATCH_ROW				(CURSOR_ROW + 2)
+#define WATCH_LINES				8
+
+#define VARIABLES_NUM				8
+
 static u13_t editor_cursor = 0x0;
 static struct termios orig_termios;
 
+/* Previously drawn frame */
+static bool_t full_redraw = 1;
+static u4_t previous_memory[MEMORY_SIZE];
+static u32_t previous_variables[VARIABLES_NUM];
+static u13_t previous_cursor = 0x0;
+static watch_entry_t previous_watch_entry = {0};
+
+/* A whole frame is written at once */
+static char out_buf[OUT_BUFFER_SIZE];
+static uint32_t out_len = 0;
+
 
 void mem_edit_reset_terminal(void)
 {
@@ -54,6 +80,8 @@ void mem_edit_configure_terminal(void)
 	atexit(mem_edit_reset_terminal);
 	cfmakeraw(&new_termios);
 	tcsetattr(0, TCSANOW, &new_termios);
+
+	full_redraw = 1;
 }
 
 static int kbhit()
@@ -79,95 +107,219 @@ static int getch()
 	}
 }
 
+static void out_flush(void)
+{
+	uint32_t pos = 0;
+	ssize_t r;
+
+	while (pos < out_len) {
+		r = write(1, &out_buf[pos], out_len - pos);
+		if (r <= 0) {
+			break;
+		}
+
+		pos += r;
+	}
+
+	out_len = 0;
+}
+
+static void out_printf(const char *fmt, ...)
+{
+	va_list arglist;
+	int r;
+
+	if (out_len > OUT_BUFFER_SIZE - 256) {
+		out_flush();
+	}
+
+	va_start(arglist, fmt);
+	r = vsnprintf(&out_buf[out_len], OUT_BUFFER_SIZE - out_len, fmt, arglist);
+	va_end(arglist);
+
+	if (r > 0) {
+		out_len += (r < OUT_BUFFER_SIZE - out_len) ? r : OUT_BUFFER_SIZE - out_len - 1;
+	}
+}
+
 static void print_editor_field(char *name, u32_t val, uint8_t depth, u12_t position)
 {
 	u12_t i;
 
-	printf("\e[1;34m%s:\e[0m 0x", name);
+	out_printf("\e[1;34m%s:\e[0m 0x", name);
 	for (i = 0; i < depth; i++) {
 		if (i + MEMORY_SIZE + position == editor_cursor) {
-			printf("\e[0;30;42m");
+			out_printf("\e[0;30;42m");
 		}
 
-		printf("%X", (val >> (4 * (depth - 1 - i))) & 0xF);
+		out_printf("%X", (val >> (4 * (depth - 1 - i))) & 0xF);
 
 		if (i + MEMORY_SIZE + position == editor_cursor) {
-			printf("\e[0m");
+			out_printf("\e[0m");
 		}
 	}
 }
 
+static const char * nibble_color(u12_t i)
+{
+	if (i == editor_cursor) {
+		return "\e[0;30;42m";
+	} else if (i >= MEM_RAM_ADDR && i < (MEM_RAM_ADDR + MEM_RAM_SIZE)) {
+		/* RAM */
+		return "\e[0m";
+	} else if (i >= MEM_DISPLAY1_ADDR && i < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
+		/* Display Memory 1 */
+		return "\e[0;35m";
+	} else if (i >= MEM_DISPLAY2_ADDR && i < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
+		/* Display Memory 2 */
+		return "\e[0;36m";
+	} else if (i >= MEM_IO_ADDR && i < (MEM_IO_ADDR + MEM_IO_SIZE)) {
+		/* I/O Memory */
+		return "\e[0;33m";
+	}
+
+	return "\e[0;90m";
+}
+
+static void print_nibble(u12_t i, u4_t val)
+{
+	/* Cursor positions are 1-based */
+	out_printf("\e[%u;%uH%s%X\e[0m", MEM_ROW + (i / MEM_LINE_SIZE), MEM_COLUMN + (i % MEM_LINE_SIZE), nibble_color(i), val);
+}
+
+static void print_variables(state_t *state)
+{
+	out_printf("\e[%u;1H", VARIABLES_ROW);
+
+	print_editor_field("PC", *(state->pc), 4, 0);
+	out_printf("    ");
+	print_editor_field("SP", *(state->sp), 2, 4);
+	out_printf("    ");
+	print_editor_field("NP", *(state->np), 2, 6);
+	out_printf("    ");
+	print_editor_field("X", *(state->x), 3, 8);
+	out_printf("    ");
+	print_editor_field("Y", *(state->y), 3, 11);
+	out_printf("    ");
+	print_editor_field("A", *(state->a), 1, 14);
+	out_printf("    ");
+	print_editor_field("B", *(state->b), 1, 15);
+	out_printf("    ");
+	print_editor_field("F", *(state->flags), 1, 16);
+	out_printf("\e[K");
+}
+
+static void print_cursor(void)
+{
+	out_printf("\e[%u;1H", CURSOR_ROW);
+
+	if (editor_cursor < MEMORY_SIZE) {
+		out_printf("\e[1;32mCursor:\e[0m 0x%04X", editor_cursor);
+	} else {
+		out_printf("\e[1;32mCursor:\e[0m Variable");
+	}
+
+	out_printf("    [ \e[1;37mRAM\e[0m    \e[1;35mDisplay 1\e[0m    \e[1;36mDisplay 2\e[0m    \e[1;33mI/O\e[0m    \e[1;90mInvalid\e[0m ]\e[K");
+}
+
+static void print_watch_history(void)
+{
+	watch_entry_t entries[WATCH_LINES];
+	char line[64];
+	uint32_t num, i;
+
+	num = watch_get_history(entries, WATCH_LINES);
+
+	/* Nothing new */
+	if (!full_redraw && num > 0 && !memcmp(&entries[num - 1], &previous_watch_entry, sizeof(watch_entry_t))) {
+		return;
+	}
+
+	out_printf("\e[%u;1H\e[1;32mWatch history:\e[0m\e[K", WATCH_ROW);
+
+	for (i = 0; i < WATCH_LINES; i++) {
+		out_printf("\e[%u;1H", WATCH_ROW + 1 + i);
+
+		if (i < num) {
+			watch_format_entry(line, sizeof(line), &entries[num - 1 - i]);
+			out_printf("%s", line);
+		}
+
+		out_printf("\e[K");
+	}
+
+	if (num > 0) {
+		previous_watch_entry = entries[num - 1];
+	}
+}
+
 void mem_edit_update(void)
 {
 	u12_t i;
 	uint8_t key;
 	state_t *state = tamalib_get_state();
 	int8_t hbyte = -1;
+	u4_t val;
+	u32_t variables[VARIABLES_NUM];
+	bool_t variables_changed = 0;
 
-	/* Clear the console */
-	printf("\e[1;1H\e[2J");
-
-	/* Memory */
-	for (i = 0; i < MEMORY_SIZE; i++) {
-		if (!(i % 0x80)) {
-			printf("\r\n\e[1;34m0x%03X:\e[0m ", i);
-		}
+	if (full_redraw) {
+		/* Clear the console */
+		out_printf("\e[1;1H\e[2J");
 
-		if (i == editor_cursor) {
-			printf("\e[0;30;42m");
-		} else if (i >= MEM_RAM_ADDR && i < (MEM_RAM_ADDR + MEM_RAM_SIZE)) {
-			/* RAM */
-		} else if (i >= MEM_DISPLAY1_ADDR && i < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
-			/* Display Memory 1 */
-			printf("\e[0;35m");
-		} else if (i >= MEM_DISPLAY2_ADDR && i < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
-			/* Display Memory 2 */
-			printf("\e[0;36m");
-		} else if (i >= MEM_IO_ADDR && i < (MEM_IO_ADDR + MEM_IO_SIZE)) {
-			/* I/O Memory */
-			printf("\e[0;33m");
-		} else {
-			printf("\e[0;90m");
+		for (i = 0; i < MEMORY_SIZE; i += MEM_LINE_SIZE) {
+			out_printf("\e[%u;1H\e[1;34m0x%03X:\e[0m", MEM_ROW + (i / MEM_LINE_SIZE), i);
 		}
+	}
 
-		printf("%X", GET_MEMORY(state->memory, i));
+	/* Memory (only what changed since the previous frame) */
+	for (i = 0; i < MEMORY_SIZE; i++) {
+		val = GET_MEMORY(state->memory, i);
 
-		if (i == editor_cursor) {
-			printf("\e[0m");
+		if (full_redraw || val != previous_memory[i] ||
+			(editor_cursor != previous_cursor && (i == editor_cursor || i == previous_cursor))) {
+			print_nibble(i, val);
+			previous_memory[i] = val;
 		}
 	}
 
-	printf("\r\n");
-	printf("\r\n");
-
 	/* Variables */
-	print_editor_field("PC", *(state->pc), 4, 0);
-	printf("    ");
-	print_editor_field("SP", *(state->sp), 2, 4);
-	printf("    ");
-	print_editor_field("NP", *(state->np), 2, 6);
-	printf("    ");
-	print_editor_field("X", *(state->x), 3, 8);
-	printf("    ");
-	print_editor_field("Y", *(state->y), 3, 11);
-	printf("    ");
-	print_editor_field("A", *(state->a), 1, 14);
-	printf("    ");
-	print_editor_field("B", *(state->b), 1, 15);
-	printf("    ");
-	print_editor_field("F", *(state->flags), 1, 16);
-	printf("\r\n");
+	variables[0] = *(state->pc);
+	variables[1] = *(state->sp);
+	variables[2] = *(state->np);
+	variables[3] = *(state->x);
+	variables[4] = *(state->y);
+	variables[5] = *(state->a);
+	variables[6] = *(state->b);
+	variables[7] = *(state->flags);
+
+	for (i = 0; i < VARIABLES_NUM; i++) {
+		if (variables[i] != previous_variables[i]) {
+			variables_changed = 1;
+			previous_variables[i] = variables[i];
+		}
+	}
 
-	printf("\r\n");
+	if (full_redraw || variables_changed || editor_cursor != previous_cursor) {
+		print_variables(state);
+	}
 
 	/* Cursor position */
-	if (editor_cursor < MEMORY_SIZE) {
-		printf("\e[1;32mCursor:\e[0m 0x%04X", editor_cursor);
-	} else {
-		printf("\e[1;32mCursor:\e[0m Variable");
+	if (full_redraw || editor_cursor != previous_cursor) {
+		print_cursor();
 	}
 
-	printf("    [ \e[1;37mRAM\e[0m    \e[1;35mDisplay 1\e[0m    \e[1;36mDisplay 2\e[0m    \e[1;33mI/O\e[0m    \e[1;90mInvalid\e[0m ]\r\n");
+	/* Watched addresses (most recent change first) */
+	if (watch_get_num() > 0) {
+		print_watch_history();
+	}
+
+	/* Park the terminal cursor below the editor */
+	out_printf("\e[%u;1H", (watch_get_num() > 0) ? WATCH_ROW + WATCH_LINES + 1 : CURSOR_ROW + 1);
+	out_flush();
+
+	full_redraw = 0;
+	previous_cursor = editor_cursor;
 
 	while (kbhit()) {
 		key = getch();
@@ -234,6 +386,7 @@ void mem_edit_update(void)
 			if (editor_cursor < MEMORY_SIZE) {
 				/* Memory */
 				SET_MEMORY(state->memory, editor_cursor, hbyte);
+				watch_request_scan();
 			} else {
 				/* Variables */
 				if ((editor_cursor & 0xFFF) < 4) {
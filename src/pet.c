@@ -0,0 +1,65 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "state.h"
+#include "pet.h"
+
+
+/* Must be called once TamaLIB is initialized, the pet starting from
+ * its current state
+ */
+int pet_init(pet_t *pet)
+{
+	memset(pet, 0, sizeof(pet_t));
+
+	pet->snapshot = (uint8_t *) SDL_malloc(state_snapshot_size());
+	if (pet->snapshot == NULL) {
+		fprintf(stderr, "FATAL: Cannot allocate the pet state !\n");
+		return -1;
+	}
+
+	state_snapshot_save(pet->snapshot);
+
+	return 0;
+}
+
+void pet_release(pet_t *pet)
+{
+	SDL_free(pet->snapshot);
+	pet->snapshot = NULL;
+}
+
+void pet_swap_out(pet_t *pet)
+{
+	state_snapshot_save(pet->snapshot);
+}
+
+void pet_swap_in(pet_t *pet)
+{
+	state_snapshot_load(pet->snapshot);
+}
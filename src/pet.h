@@ -0,0 +1,50 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _PET_H_
+#define _PET_H_
+
+#include <stdint.h>
+
+#include "lib/tamalib.h"
+
+#define PET_MAX				16
+
+/* Everything specific to one emulated device. TamaLIB only handles a single
+ * CPU, so the pets take turns, their state being swapped in and out of it.
+ */
+typedef struct {
+	uint8_t *snapshot; // TamaLIB state while not running
+	uint64_t ticks; // Emulated ticks run so far
+	bool_t done;
+
+	/* Outputs, filled by the HAL while running */
+	bool_t matrix[LCD_HEIGHT][LCD_WIDTH];
+	bool_t icons[ICON_NUM];
+	u32_t freq; // in dHz
+	bool_t buzzer;
+} pet_t;
+
+
+int pet_init(pet_t *pet);
+void pet_release(pet_t *pet);
+void pet_swap_out(pet_t *pet);
+void pet_swap_in(pet_t *pet);
+
+#endif /* _PET_H_ */
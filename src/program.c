@@ -21,6 +21,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#if !defined(__WIN32__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#endif
 
 #include "SDL.h"
 
@@ -33,13 +40,46 @@
 #define CRC_DETECTION_OFFSET				0x2F0
 #define CRC_DETECTION_LENGTH				0x110
 
+#define CRC_POLYNOMIAL					0xEDB88320
+
+#define HEADER_BUFFER_SIZE				65536
+
+#define SHARED_ROM_TEMPLATE				"%s/tamatool-rom-%08X-%u.bin"
+
+/* LBPX loads 8 bits at once */
+#define SPRITE_HEIGHT					8
+#define SPRITE_ROW_HEIGHT				(SPRITE_HEIGHT + 2) // Including the bounds
+
+/* Palette used for indexed sprite sheets */
+#define PALETTE_OFF					0
+#define PALETTE_ON					1
+#define PALETTE_BORDER					2
+#define PALETTE_NUM					3
+
+#define DATA_MAP_FILE_MAGIC				"TLSI"
+#define DATA_MAP_FILE_VERSION				1
+#define DATA_MAP_HEADER_SIZE				13
+#define DATA_MAP_ENTRY_SIZE				12
+#define DATA_MAP_INITIAL_CAPACITY			256
+
 typedef struct map {
 	uint32_t ref;
 	uint32_t width;
 	uint32_t height;
 } map_t;
 
-static map_t g_map[MAX_SPRITES];
+typedef struct {
+	map_t *entries;
+	uint32_t num;
+	uint32_t capacity;
+	uint32_t max_width;
+} data_map_t;
+
+static data_map_t g_map = {0};
+
+/* Slicing-by-8 tables, generated on first use */
+static uint32_t g_crc_table[8][256];
+static bool_t g_crc_table_ready = 0;
 
 char *rom_type_str[ROM_TYPE_MAX] = {
 	[ROM_TYPE_P1] = "p1",
@@ -47,6 +87,101 @@ char *rom_type_str[ROM_TYPE_MAX] = {
 	[ROM_TYPE_ANGEL] = "angel",
 };
 
+/* Known ROMs, identified by the CRC of their detection window rather than
+ * by their whole-ROM fingerprint, since the fingerprints of the existing
+ * dumps (and their revisions) are not recorded. Any dump sharing the window
+ * of a known ROM is then handled as that ROM, whatever its revision.
+ */
+static const rom_info_t g_known_roms[] = {
+	{ .crc = 0xC7875F27, .type = ROM_TYPE_P1, .mcu = "E0C6S46", .size = 6144 },
+	{ .crc = 0xBB79B1B2, .type = ROM_TYPE_P2, .mcu = "E0C6S46", .size = 6144 },
+	{ .crc = 0x3CA006E6, .type = ROM_TYPE_ANGEL, .mcu = "E0C6S48", .size = 8192 },
+};
+
+
+static void crc32_init_tables(void)
+{
+	uint32_t i, j;
+	uint32_t crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = crc & 1 ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+		}
+		g_crc_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			g_crc_table[j][i] = (g_crc_table[j - 1][i] >> 8) ^ g_crc_table[0][g_crc_table[j - 1][i] & 0xFF];
+		}
+	}
+
+	g_crc_table_ready = 1;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+	uint32_t lo, hi;
+
+	if (!g_crc_table_ready) {
+		crc32_init_tables();
+	}
+
+	crc = ~crc;
+
+	/* Eight bytes at a time */
+	while (length >= 8) {
+		lo = (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24)) ^ crc;
+		hi = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24);
+
+		crc = g_crc_table[7][lo & 0xFF] ^ g_crc_table[6][(lo >> 8) & 0xFF] ^
+			g_crc_table[5][(lo >> 16) & 0xFF] ^ g_crc_table[4][lo >> 24] ^
+			g_crc_table[3][hi & 0xFF] ^ g_crc_table[2][(hi >> 8) & 0xFF] ^
+			g_crc_table[1][(hi >> 16) & 0xFF] ^ g_crc_table[0][hi >> 24];
+
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = (crc >> 8) ^ g_crc_table[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+static uint32_t crc32(const uint8_t *data, uint32_t length)
+{
+	return crc32_update(0, data, length);
+}
+
+uint32_t program_fingerprint(u12_t *program, uint32_t size)
+{
+	uint8_t buf[512];
+	uint32_t crc = 0;
+	uint32_t i, n;
+
+	/* CRC of the whole ROM, as stored in the ROM file (16 bits big-endian
+	 * per instruction), so that it matches the CRC of the file itself
+	 */
+	while (size > 0) {
+		n = (size > sizeof(buf)/2) ? sizeof(buf)/2 : size;
+
+		for (i = 0; i < n; i++) {
+			buf[i * 2] = (program[i] >> 8) & 0xF;
+			buf[i * 2 + 1] = program[i] & 0xFF;
+		}
+
+		crc = crc32_update(crc, buf, n * 2);
+		program += n;
+		size -= n;
+	}
+
+	return crc;
+}
+
 
 u12_t * program_load(char *path, uint32_t *size)
 {
@@ -113,211 +248,750 @@ void program_save(char *path, u12_t *program, uint32_t size)
 	SDL_RWclose(f);
 }
 
-void program_to_header(u12_t *program, uint32_t size)
+#if !defined(__WIN32__)
+/* Every instance mapping the shared ROM holds a shared lock on it, so that
+ * the last one leaving can remove it. A file left behind by a crashed
+ * instance is reused, then removed by the next instance leaving last.
+ */
+static char g_shared_path[300];
+static int g_shared_fd = -1;
+
+static const char * shared_rom_folder(void)
+{
+	const char *folder;
+
+	/* Prefer a RAM backed folder, so that the mapping never hits the disk */
+	if (access("/dev/shm", W_OK) == 0) {
+		return "/dev/shm";
+	}
+
+	folder = getenv("TMPDIR");
+	if (folder != NULL && folder[0]) {
+		return folder;
+	}
+
+	return "/tmp";
+}
+
+static int publish_shared_rom(char *path, u12_t *program, uint32_t size)
+{
+	char tmp_path[320];
+	int fd;
+	ssize_t len = size * sizeof(u12_t);
+
+	/* Write to a private file first, then atomically rename it, so that
+	 * other instances never map a partially written ROM. The folder might
+	 * be world-writable, so the name must not be predictable.
+	 */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (write(fd, program, len) != len || fchmod(fd, 0444) < 0) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	close(fd);
+
+	if (rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+u12_t * program_share(u12_t *program, uint32_t size)
 {
+	char *path = g_shared_path;
+	struct stat st, path_st;
+	u12_t *shared;
+	int fd;
+
+	snprintf(path, sizeof(g_shared_path), SHARED_ROM_TEMPLATE, shared_rom_folder(), program_fingerprint(program, size), size);
+
+	while (1) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			/* First instance using this ROM */
+			if (publish_shared_rom(path, program, size) < 0) {
+				fprintf(stderr, "Cannot create shared ROM \"%s\" !\n", path);
+				return NULL;
+			}
+
+			fd = open(path, O_RDONLY);
+			if (fd < 0) {
+				fprintf(stderr, "Cannot open shared ROM \"%s\" !\n", path);
+				return NULL;
+			}
+		}
+
+		if (flock(fd, LOCK_SH) < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "Cannot lock shared ROM \"%s\" !\n", path);
+			close(fd);
+			return NULL;
+		}
+
+		/* The last user might have removed the file in the meantime */
+		if (stat(path, &path_st) == 0 && path_st.st_dev == st.st_dev && path_st.st_ino == st.st_ino) {
+			break;
+		}
+
+		close(fd);
+	}
+
+	if (st.st_size != size * sizeof(u12_t)) {
+		fprintf(stderr, "Invalid shared ROM \"%s\" !\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	shared = (u12_t *) mmap(NULL, size * sizeof(u12_t), PROT_READ, MAP_SHARED, fd, 0);
+
+	if (shared == MAP_FAILED) {
+		fprintf(stderr, "Cannot map shared ROM \"%s\" !\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	/* The name is only a hash, make sure this is actually the same ROM */
+	if (memcmp(shared, program, size * sizeof(u12_t))) {
+		fprintf(stderr, "Shared ROM \"%s\" does not match !\n", path);
+		munmap(shared, size * sizeof(u12_t));
+		close(fd);
+		return NULL;
+	}
+
+	/* The lock lives as long as the file descriptor */
+	g_shared_fd = fd;
+
+	return shared;
+}
+
+void program_unshare(u12_t *program, uint32_t size)
+{
+	struct stat st, path_st;
+	int fd;
+
+	munmap(program, size * sizeof(u12_t));
+
+	if (g_shared_fd < 0) {
+		return;
+	}
+
+	/* Upgrading the shared lock is not atomic on every system, two
+	 * instances leaving together could both fail. The shared lock is
+	 * released instead, then an exclusive one is requested through a new
+	 * descriptor: only one of the instances leaving last can get it.
+	 */
+	close(g_shared_fd);
+	g_shared_fd = -1;
+
+	fd = open(g_shared_path, O_RDONLY);
+	if (fd < 0) {
+		/* Already removed */
+		return;
+	}
+
+	/* The file must not have been replaced in the meantime */
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0 && fstat(fd, &st) == 0 &&
+		stat(g_shared_path, &path_st) == 0 && path_st.st_dev == st.st_dev && path_st.st_ino == st.st_ino) {
+		unlink(g_shared_path);
+	}
+
+	close(fd);
+}
+#else
+u12_t * program_share(u12_t *program, uint32_t size)
+{
+	fprintf(stderr, "Shared ROMs are not supported on this platform !\n");
+	return NULL;
+}
+
+void program_unshare(u12_t *program, uint32_t size)
+{
+}
+#endif
+
+static void header_flush(char *buf, uint32_t *len)
+{
+	fwrite(buf, 1, *len, stdout);
+	*len = 0;
+}
+
+static void header_put_hex(char *buf, uint32_t *len, uint32_t val, uint8_t digits)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	buf[(*len)++] = '0';
+	buf[(*len)++] = 'x';
+
+	while (digits--) {
+		buf[(*len)++] = hex[(val >> (4 * digits)) & 0xF];
+	}
+
+	buf[(*len)++] = ',';
+}
+
+static void header_put_separator(char *buf, uint32_t *len, uint32_t i, uint32_t per_line)
+{
+	if (!(i % per_line)) {
+		buf[(*len)++] = '\n';
+		buf[(*len)++] = '\t';
+	} else {
+		buf[(*len)++] = ' ';
+	}
+}
+
+void program_to_header(u12_t *program, uint32_t size, bool_t packed)
+{
+	char buf[HEADER_BUFFER_SIZE];
+	uint32_t len = 0;
 	uint32_t i;
+	u12_t w0, w1;
 
-	fprintf(stdout, "static const u12_t g_program[] = {");
+	if (!packed) {
+		fprintf(stdout, "static const u12_t g_program[] = {");
 
-	for (i = 0; i < size; i++) {
-		if (!(i % 16)) {
-			fprintf(stdout, "\n\t");
-		} else {
-			fprintf(stdout, " ");
+		for (i = 0; i < size; i++) {
+			if (len > HEADER_BUFFER_SIZE - 16) {
+				header_flush(buf, &len);
+			}
+
+			header_put_separator(buf, &len, i, 16);
+			header_put_hex(buf, &len, program[i], 3);
+		}
+
+		header_flush(buf, &len);
+		fprintf(stdout, "\n};\n");
+		return;
+	}
+
+	/* Two 12-bit words are packed in three bytes (big-endian), the last
+	 * word being padded with zeros if needed
+	 */
+	fprintf(stdout, "#define G_PROGRAM_SIZE\t\t%u\n\n", size);
+	fprintf(stdout, "static const u8_t g_program_packed[] = {");
+
+	for (i = 0; i < size; i += 2) {
+		if (len > HEADER_BUFFER_SIZE - 32) {
+			header_flush(buf, &len);
 		}
 
-		fprintf(stdout, "0x%03X,", program[i]);
+		w0 = program[i] & 0xFFF;
+		w1 = (i + 1 < size) ? (program[i + 1] & 0xFFF) : 0;
+
+		header_put_separator(buf, &len, (i/2) * 3, 24);
+		header_put_hex(buf, &len, w0 >> 4, 2);
+		header_put_separator(buf, &len, (i/2) * 3 + 1, 24);
+		header_put_hex(buf, &len, ((w0 & 0xF) << 4) | (w1 >> 8), 2);
+		header_put_separator(buf, &len, (i/2) * 3 + 2, 24);
+		header_put_hex(buf, &len, w1 & 0xFF, 2);
 	}
 
-	fprintf(stdout, "\n};\n");
+	header_flush(buf, &len);
+	fprintf(stdout, "\n};\n\n");
+
+	/* Matching unpack routine */
+	fprintf(stdout,
+		"static inline u12_t g_program_get(u13_t n)\n"
+		"{\n"
+		"\tconst u8_t *p = &g_program_packed[(n >> 1) * 3];\n"
+		"\n"
+		"\treturn (n & 1) ? (((p[1] & 0xF) << 8) | p[2]) : ((p[0] << 4) | (p[1] >> 4));\n"
+		"}\n");
+}
+
+static void free_data_map(data_map_t *map)
+{
+	SDL_free(map->entries);
+	map->entries = NULL;
+	map->num = 0;
+	map->capacity = 0;
+	map->max_width = 0;
+}
+
+static int add_data_map_entry(data_map_t *map, uint32_t ref, uint32_t width, uint32_t height)
+{
+	map_t *entries;
+	uint32_t capacity;
+
+	if (map->num == map->capacity) {
+		capacity = (map->capacity > 0) ? map->capacity * 2 : DATA_MAP_INITIAL_CAPACITY;
+
+		entries = (map_t *) SDL_realloc(map->entries, capacity * sizeof(map_t));
+		if (entries == NULL) {
+			fprintf(stderr, "FATAL: Cannot allocate the sprite index !\n");
+			return -1;
+		}
+
+		map->entries = entries;
+		map->capacity = capacity;
+	}
+
+	map->entries[map->num].ref = ref;
+	map->entries[map->num].width = width;
+	map->entries[map->num].height = height;
+
+	if (width > map->max_width) {
+		map->max_width = width;
+	}
+
+	map->num++;
+
+	return 0;
 }
 
-static uint32_t generate_data_map(map_t *map, u12_t *program, uint32_t size, uint32_t *max_width)
+static int generate_data_map(data_map_t *map, u12_t *program, uint32_t size)
 {
 	uint32_t i;
-	uint32_t count = 0;
 	uint32_t width = 0;
 
-	*max_width = 0;
+	free_data_map(map);
 
 	/* Parse the program to get a map */
 	for (i = 0; i < size; i++) {
 		if ((program[i] >> 8) == 0x9) {
 			/* LBPX */
-			if (width == 0) {
-			}
-
 			width++;
 		} else {
 			/* RETD */
 			if ((program[i] >> 8) == 0x1 && width != 0) {
-				map[count].ref = i - width;
-				map[count].width = width + 1;
-				map[count].height = 8;
-
-				if (map[count].width > *max_width) {
-					*max_width = map[count].width;
+				if (add_data_map_entry(map, i - width, width + 1, SPRITE_HEIGHT) < 0) {
+					free_data_map(map);
+					return -1;
 				}
-
-				count++;
 			}
 
 			width = 0;
 		}
 	}
 
-	return count;
+	return 0;
 }
 
-void program_get_data(u12_t *program, uint32_t size, char *path)
+static uint32_t read_u32(uint8_t *buf)
 {
-	uint32_t i, j, k;
-	uint8_t depth;
-	uint32_t sprite_num = 0;
-	uint32_t img_width;
-	image_t img;
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
 
-	sprite_num = generate_data_map(g_map, program, size, &img_width);
+static void write_u32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val & 0xFF;
+	buf[1] = (val >> 8) & 0xFF;
+	buf[2] = (val >> 16) & 0xFF;
+	buf[3] = (val >> 24) & 0xFF;
+}
 
-	/* Create an image file from the map */
-	img.width = img_width + 2;
-	img.height = sprite_num * 10;
-	img.color_type = PNG_COLOR_TYPE_RGBA;
-	img.bit_depth = 8;
-	depth = img.bit_depth/8 * 4;
-	img.stride = img.width * depth;
+static int load_data_map(data_map_t *map, char *path, uint32_t fingerprint, uint32_t size)
+{
+	SDL_RWops *f;
+	uint8_t header[DATA_MAP_HEADER_SIZE];
+	uint8_t *buf;
+	uint32_t num, i;
 
-	image_alloc(&img);
+	f = SDL_RWFromFile(path, "rb");
+	if (f == NULL) {
+		return -1;
+	}
+
+	/* Magic, version, ROM fingerprint and number of entries, then the
+	 * entries (ref, width, height) written as u32 little-endian
+	 */
+	if (SDL_RWread(f, header, DATA_MAP_HEADER_SIZE, 1) != 1 ||
+		memcmp(header, DATA_MAP_FILE_MAGIC, 4) || header[4] != DATA_MAP_FILE_VERSION ||
+		read_u32(&header[5]) != fingerprint) {
+		/* Not an index of this ROM */
+		SDL_RWclose(f);
+		return -1;
+	}
+
+	num = read_u32(&header[9]);
+	if (num > size) {
+		SDL_RWclose(f);
+		return -1;
+	}
+
+	buf = (uint8_t *) SDL_malloc(num * DATA_MAP_ENTRY_SIZE + 1);
+	if (buf == NULL) {
+		SDL_RWclose(f);
+		return -1;
+	}
+
+	if (num > 0 && SDL_RWread(f, buf, num * DATA_MAP_ENTRY_SIZE, 1) != 1) {
+		SDL_free(buf);
+		SDL_RWclose(f);
+		return -1;
+	}
 
-	for (i = 0; i < sprite_num; i++) {
-		/* Bounds */
-		for (k = 0; k < g_map[i].height + 2; k++) {
-			img.row_pointers[i * 10 + k][0] = 0xFF;
-			img.row_pointers[i * 10 + k][1] = 0x00;
-			img.row_pointers[i * 10 + k][2] = 0x00;
-			img.row_pointers[i * 10 + k][3] = 0xFF;
-
-			img.row_pointers[i * 10 + k][depth * (g_map[i].width + 1)] = 0xFF;
-			img.row_pointers[i * 10 + k][depth * (g_map[i].width + 1) + 1] = 0x00;
-			img.row_pointers[i * 10 + k][depth * (g_map[i].width + 1) + 2] = 0x00;
-			img.row_pointers[i * 10 + k][depth * (g_map[i].width + 1) + 3] = 0xFF;
+	SDL_RWclose(f);
+
+	free_data_map(map);
+
+	for (i = 0; i < num; i++) {
+		uint8_t *entry = &buf[i * DATA_MAP_ENTRY_SIZE];
+
+		/* Checked without any sum, that could wrap */
+		if (read_u32(&entry[0]) >= size || read_u32(&entry[4]) > size - read_u32(&entry[0]) || read_u32(&entry[8]) != SPRITE_HEIGHT ||
+			add_data_map_entry(map, read_u32(&entry[0]), read_u32(&entry[4]), read_u32(&entry[8])) < 0) {
+			/* Corrupted index */
+			free_data_map(map);
+			SDL_free(buf);
+			return -1;
 		}
-		for (j = 0; j < g_map[i].width + 2; j++) {
-			img.row_pointers[i * 10][depth * j] = 0xFF;
-			img.row_pointers[i * 10][depth * j + 1] = 0x00;
-			img.row_pointers[i * 10][depth * j + 2] = 0x00;
-			img.row_pointers[i * 10][depth * j + 3] = 0xFF;
-
-			img.row_pointers[i * 10 + (g_map[i].height + 1)][depth * j] = 0xFF;
-			img.row_pointers[i * 10 + (g_map[i].height + 1)][depth * j + 1] = 0x00;
-			img.row_pointers[i * 10 + (g_map[i].height + 1)][depth * j + 2] = 0x00;
-			img.row_pointers[i * 10 + (g_map[i].height + 1)][depth * j + 3] = 0xFF;
+	}
+
+	SDL_free(buf);
+
+	return 0;
+}
+
+static void save_data_map(data_map_t *map, char *path, uint32_t fingerprint)
+{
+	SDL_RWops *f;
+	uint8_t header[DATA_MAP_HEADER_SIZE];
+	uint8_t *buf;
+	uint32_t i;
+
+	buf = (uint8_t *) SDL_malloc(map->num * DATA_MAP_ENTRY_SIZE + 1);
+	if (buf == NULL) {
+		return;
+	}
+
+	memcpy(header, DATA_MAP_FILE_MAGIC, 4);
+	header[4] = DATA_MAP_FILE_VERSION;
+	write_u32(&header[5], fingerprint);
+	write_u32(&header[9], map->num);
+
+	for (i = 0; i < map->num; i++) {
+		write_u32(&buf[i * DATA_MAP_ENTRY_SIZE], map->entries[i].ref);
+		write_u32(&buf[i * DATA_MAP_ENTRY_SIZE + 4], map->entries[i].width);
+		write_u32(&buf[i * DATA_MAP_ENTRY_SIZE + 8], map->entries[i].height);
+	}
+
+	/* The index is only a cache, it is simply regenerated next time if
+	 * it cannot be written
+	 */
+	f = SDL_RWFromFile(path, "wb");
+	if (f == NULL) {
+		SDL_free(buf);
+		return;
+	}
+
+	if (SDL_RWwrite(f, header, DATA_MAP_HEADER_SIZE, 1) != 1 ||
+		(map->num > 0 && SDL_RWwrite(f, buf, map->num * DATA_MAP_ENTRY_SIZE, 1) != 1)) {
+		SDL_RWclose(f);
+		remove(path);
+		SDL_free(buf);
+		return;
+	}
+
+	SDL_RWclose(f);
+	SDL_free(buf);
+}
+
+static int get_data_map(data_map_t *map, u12_t *program, uint32_t size, char *index_path)
+{
+	uint32_t fingerprint;
+
+	if (index_path == NULL) {
+		return generate_data_map(map, program, size);
+	}
+
+	/* The index is only valid for the ROM it has been generated from */
+	fingerprint = program_fingerprint(program, size);
+
+	if (!load_data_map(map, index_path, fingerprint, size)) {
+		return 0;
+	}
+
+	if (generate_data_map(map, program, size) < 0) {
+		return -1;
+	}
+
+	save_data_map(map, index_path, fingerprint);
+
+	return 0;
+}
+
+static uint32_t rgba_pixel(png_byte r, png_byte g, png_byte b, png_byte a)
+{
+	png_byte p[4] = {r, g, b, a};
+	uint32_t v;
+
+	/* Memory order, whatever the endianness */
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static void fill_pixels(uint32_t *dst, uint32_t num, uint32_t val)
+{
+	uint32_t i;
+
+	for (i = 0; i < num; i++) {
+		dst[i] = val;
+	}
+}
+
+/* Expands one bit of each LBPX word of a sprite to a whole row of pixels.
+ * The loop is branchless so that the compiler can vectorize it.
+ */
+static void expand_sprite_row(uint32_t *dst, const u12_t *words, uint32_t width, uint8_t bit, uint32_t on, uint32_t off)
+{
+	uint32_t j, mask;
+
+	for (j = 0; j < width; j++) {
+		mask = -(uint32_t) ((words[j] >> bit) & 0x1);
+		dst[j] = (on & mask) | (off & ~mask);
+	}
+}
+
+/* Packs the alpha channel of a whole row of pixels into one bit of each
+ * LBPX word of a sprite (accumulated in bits).
+ */
+static void pack_sprite_row(uint8_t *bits, const png_byte *src, uint32_t width, uint8_t depth, uint8_t bit)
+{
+	uint32_t j;
+
+	for (j = 0; j < width; j++) {
+		bits[j] |= (src[j * depth + 3] != 0x00) << bit;
+	}
+}
+
+static void expand_sprite_row_indexed(uint8_t *dst, const u12_t *words, uint32_t width, uint8_t bit, uint8_t on, uint8_t off)
+{
+	uint32_t j;
+	uint8_t mask;
+
+	for (j = 0; j < width; j++) {
+		mask = -(uint8_t) ((words[j] >> bit) & 0x1);
+		dst[j] = (on & mask) | (off & ~mask);
+	}
+}
+
+void program_get_data(u12_t *program, uint32_t size, char *path, char *index_path, bool_t indexed, int compression_level, int filters)
+{
+	uint32_t i, k;
+	uint32_t border, on, off;
+	image_t img;
+	png_color palette[PALETTE_NUM] = {
+		[PALETTE_OFF] = {0x00, 0x00, 0x00},
+		[PALETTE_ON] = {0x00, 0x00, 0x00},
+		[PALETTE_BORDER] = {0xFF, 0x00, 0x00},
+	};
+	png_byte trans[] = {
+		[PALETTE_OFF] = 0x00,
+	};
+
+	if (get_data_map(&g_map, program, size, index_path) < 0) {
+		return;
+	}
+
+	/* Create an image file from the map */
+	img.width = g_map.max_width + 2;
+	img.height = g_map.num * SPRITE_ROW_HEIGHT;
+
+	if (indexed) {
+		/* Only three colors are needed */
+		img.color_type = PNG_COLOR_TYPE_PALETTE;
+		img.bit_depth = 2;
+		img.palette = palette;
+		img.num_palette = PALETTE_NUM;
+		img.trans = trans;
+		img.num_trans = sizeof(trans);
+		img.stride = img.width;
+
+		/* Filtering is useless for palette images */
+		if (filters == IMAGE_DEFAULT) {
+			filters = PNG_FILTER_NONE;
 		}
+	} else {
+		img.color_type = PNG_COLOR_TYPE_RGBA;
+		img.bit_depth = 8;
+		img.stride = img.width * 4;
+	}
 
-		/* Sprite */
-		for (k = 0; k < g_map[i].height; k++) {
-			for (j = 0; j < g_map[i].width; j++) {
-				if ((program[g_map[i].ref + j] >> k) & 0x1) {
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1)] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 1] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 2] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 3] = 0xFF;
-				} else {
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1)] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 1] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 2] = 0x00;
-					img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 3] = 0x00;
-				}
+	image_alloc(&img);
+	if (img.row_pointers == NULL) {
+		free_data_map(&g_map);
+		return;
+	}
+
+	border = rgba_pixel(0xFF, 0x00, 0x00, 0xFF);
+	on = rgba_pixel(0x00, 0x00, 0x00, 0xFF);
+	off = rgba_pixel(0x00, 0x00, 0x00, 0x00);
+
+	for (i = 0; i < g_map.num; i++) {
+		map_t *m = &g_map.entries[i];
+		png_bytepp rows = &img.row_pointers[i * SPRITE_ROW_HEIGHT];
+
+		if (indexed) {
+			/* Bounds */
+			memset(rows[0], PALETTE_BORDER, m->width + 2);
+			memset(rows[m->height + 1], PALETTE_BORDER, m->width + 2);
+
+			/* Sprite */
+			for (k = 0; k < m->height; k++) {
+				rows[k + 1][0] = PALETTE_BORDER;
+				expand_sprite_row_indexed(rows[k + 1] + 1, &program[m->ref], m->width, k, PALETTE_ON, PALETTE_OFF);
+				rows[k + 1][m->width + 1] = PALETTE_BORDER;
+			}
+		} else {
+			/* Bounds */
+			fill_pixels((uint32_t *) rows[0], m->width + 2, border);
+			fill_pixels((uint32_t *) rows[m->height + 1], m->width + 2, border);
+
+			/* Sprite */
+			for (k = 0; k < m->height; k++) {
+				((uint32_t *) rows[k + 1])[0] = border;
+				expand_sprite_row((uint32_t *) rows[k + 1] + 1, &program[m->ref], m->width, k, on, off);
+				((uint32_t *) rows[k + 1])[m->width + 1] = border;
 			}
 		}
 	}
 
-	printf("Writing %u sprites to file %s (%ux%u px)...\n", sprite_num, path, img.width, img.height);
-	image_write_file(path, &img);
+	printf("Writing %u sprites to file %s (%ux%u px)...\n", g_map.num, path, img.width, img.height);
+	image_write_file(path, &img, compression_level, filters);
 
 	image_free(&img);
+	free_data_map(&g_map);
 }
 
-void program_set_data(u12_t *program, uint32_t size, char *path)
+void program_set_data(u12_t *program, uint32_t size, char *path, char *index_path)
 {
 	uint32_t i, j, k;
 	uint8_t depth;
-	uint32_t sprite_num = 0;
-	uint32_t img_width;
+	uint8_t *bits;
 	image_t img;
 
 	image_read_file(path, &img);
-	printf("Reading %u sprites from file %s (%ux%u px)...\n", img.height/10, path, img.width, img.height);
+	if (img.row_pointers == NULL) {
+		return;
+	}
+
+	printf("Reading %u sprites from file %s (%ux%u px)...\n", img.height/SPRITE_ROW_HEIGHT, path, img.width, img.height);
 
-	sprite_num = generate_data_map(g_map, program, size, &img_width);
+	if (get_data_map(&g_map, program, size, index_path) < 0) {
+		image_free(&img);
+		return;
+	}
 
-	if (img_width + 2 != img.width)  {
-		fprintf(stderr, "FATAL: Invalid image width (%u != %u) !\n", img.width, img_width + 2);
+	if (g_map.max_width + 2 != img.width)  {
+		fprintf(stderr, "FATAL: Invalid image width (%u != %u) !\n", img.width, g_map.max_width + 2);
+		image_free(&img);
+		free_data_map(&g_map);
 		return;
 	}
 
-	if (sprite_num != img.height/10)  {
-		fprintf(stderr, "FATAL: Invalid number of sprites (%u != %u) !\n", img.height/10, sprite_num);
+	if (g_map.num != img.height/SPRITE_ROW_HEIGHT)  {
+		fprintf(stderr, "FATAL: Invalid number of sprites (%u != %u) !\n", img.height/SPRITE_ROW_HEIGHT, g_map.num);
+		image_free(&img);
+		free_data_map(&g_map);
 		return;
 	}
 
 	depth = img.bit_depth/8 * 4;
 
-	for (i = 0; i < sprite_num; i++) {
-		/* Sprite */
-		for (k = 0; k < g_map[i].height; k++) {
-			for (j = 0; j < g_map[i].width; j++) {
-				program[g_map[i].ref + j] &= ~(0x1 << k);
+	bits = (uint8_t *) SDL_malloc(g_map.max_width + 1);
+	if (bits == NULL) {
+		fprintf(stderr, "FATAL: Cannot allocate sprite memory !\n");
+		image_free(&img);
+		free_data_map(&g_map);
+		return;
+	}
 
-				/* Use alpha channel only */
-				if (img.row_pointers[i * 10 + k + 1][depth * (j + 1) + 3] != 0x00) {
-					program[g_map[i].ref + j] |= 0x1 << k;
-				}
-			}
+	for (i = 0; i < g_map.num; i++) {
+		map_t *m = &g_map.entries[i];
+		png_bytepp rows = &img.row_pointers[i * SPRITE_ROW_HEIGHT];
+
+		/* Sprite (use alpha channel only) */
+		memset(bits, 0, m->width);
+		for (k = 0; k < m->height; k++) {
+			pack_sprite_row(bits, rows[k + 1] + depth, m->width, depth, k);
+		}
+
+		for (j = 0; j < m->width; j++) {
+			program[m->ref + j] = (program[m->ref + j] & ~0xFF) | bits[j];
 		}
 	}
 
+	SDL_free(bits);
 	image_free(&img);
+
+	/* Only the sprite data changed, so the index is still valid for the
+	 * modified ROM
+	 */
+	if (index_path != NULL) {
+		save_data_map(&g_map, index_path, program_fingerprint(program, size));
+	}
+
+	free_data_map(&g_map);
 }
 
-static uint32_t crc32(const char *data, uint32_t length) {
-	uint32_t crc = ~0U;
-	uint8_t i;
+const rom_info_t * program_identify(u12_t *program, uint32_t size)
+{
+	uint32_t crc;
+	uint32_t i;
 
-	while (length--) {
-		crc ^= (unsigned char) *data++;
-		for (i = 0; i < 8; i++) {
-			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	if (size * sizeof(u12_t) < CRC_DETECTION_OFFSET + CRC_DETECTION_LENGTH) {
+		return NULL;
+	}
+
+	/* This cast assumes that u12_t are actually stored in uint16_t */
+	crc = crc32((const uint8_t *) program + CRC_DETECTION_OFFSET, CRC_DETECTION_LENGTH);
+
+	for (i = 0; i < sizeof(g_known_roms)/sizeof(g_known_roms[0]); i++) {
+		if (g_known_roms[i].crc == crc) {
+			return &g_known_roms[i];
 		}
 	}
 
-	return ~crc;
+	return NULL;
 }
 
-rom_type_t program_detect_type(u12_t *program)
+rom_type_t program_detect_type(u12_t *program, uint32_t size)
 {
-	/* This cast assumes that u12_t are actually stored in uint16_t */
-	uint32_t crc = crc32((const char *) &program[CRC_DETECTION_OFFSET/2], CRC_DETECTION_LENGTH);
+	const rom_info_t *info = program_identify(program, size);
 
-	switch (crc) {
-		case 0xC7875F27:
-			return ROM_TYPE_P1;
+	if (info == NULL) {
+		fprintf(stderr, "WARNING: Unknown ROM (fingerprint 0x%08X), assuming it is a %s (use -t to force the type) !\n",
+			program_fingerprint(program, size), rom_type_str[ROM_TYPE_P1]);
 
-		case 0xBB79B1B2:
-			return ROM_TYPE_P2;
+		/* Default is Tamagotchi P1 */
+		return ROM_TYPE_P1;
+	}
 
-		case 0x3CA006E6:
-			return ROM_TYPE_ANGEL;
+	return info->type;
+}
 
-		default:
-			/* Default is Tamagotchi P1 */
-			return ROM_TYPE_P1;
-	}
+char * program_detect_type_str(u12_t *program, uint32_t size)
+{
+	return rom_type_str[program_detect_type(program, size)];
 }
 
-char * program_detect_type_str(u12_t *program)
+void program_print_info(u12_t *program, uint32_t size)
 {
-	return rom_type_str[program_detect_type(program)];
+	const rom_info_t *info = program_identify(program, size);
+
+	fprintf(stdout, "Size:        %u * 12bits\n", size);
+	fprintf(stdout, "Fingerprint: 0x%08X\n", program_fingerprint(program, size));
+
+	if (info != NULL) {
+		fprintf(stdout, "Type:        %s\n", rom_type_str[info->type]);
+		fprintf(stdout, "MCU:         %s\n", info->mcu);
+
+		if (size != info->size) {
+			fprintf(stdout, "WARNING: Unexpected size for this type (should be %u * 12bits) !\n", info->size);
+		}
+	} else {
+		fprintf(stdout, "Type:        unknown\n");
+	}
 }
 
 char * program_validate_type_str(char *type)
@@ -22,8 +22,6 @@
 
 #include "hal_types.h"
 
-#define MAX_SPRITES			256
-
 typedef enum {
 	ROM_TYPE_P1 = 0,
 	ROM_TYPE_P2 = 1,
@@ -31,16 +29,28 @@ typedef enum {
 	ROM_TYPE_MAX
 } rom_type_t;
 
+typedef struct {
+	uint32_t crc; // CRC of the detection window
+	rom_type_t type;
+	char *mcu;
+	uint32_t size; // Expected size in 12-bit words
+} rom_info_t;
+
 extern char *rom_type_str[ROM_TYPE_MAX];
 
 
 u12_t * program_load(char *path, uint32_t *size);
 void program_save(char *path, u12_t *program, uint32_t size);
-void program_to_header(u12_t *program, uint32_t size);
-void program_get_data(u12_t *program, uint32_t size, char *path);
-void program_set_data(u12_t *program, uint32_t size, char *path);
-rom_type_t program_detect_type(u12_t *program);
-char * program_detect_type_str(u12_t *program);
+u12_t * program_share(u12_t *program, uint32_t size);
+void program_unshare(u12_t *program, uint32_t size);
+void program_to_header(u12_t *program, uint32_t size, bool_t packed);
+void program_get_data(u12_t *program, uint32_t size, char *path, char *index_path, bool_t indexed, int compression_level, int filters);
+void program_set_data(u12_t *program, uint32_t size, char *path, char *index_path);
+uint32_t program_fingerprint(u12_t *program, uint32_t size);
+const rom_info_t * program_identify(u12_t *program, uint32_t size);
+rom_type_t program_detect_type(u12_t *program, uint32_t size);
+char * program_detect_type_str(u12_t *program, uint32_t size);
+void program_print_info(u12_t *program, uint32_t size);
 char * program_validate_type_str(char *type);
 
 #endif /* _PROGRAM_H_ */
@@ -0,0 +1,142 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#if !defined(__WIN32__)
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "shm_export.h"
+
+static shm_export_t *g_export = NULL;
+static char g_name[256];
+
+
+int shm_export_open(char *name)
+{
+	int fd;
+
+	/* POSIX names must start with a slash */
+	snprintf(g_name, sizeof(g_name), "%s%s", (name[0] == '/') ? "" : "/", name);
+
+	fd = shm_open(g_name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "FATAL: Cannot create shared memory \"%s\" !\n", g_name);
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(shm_export_t)) < 0) {
+		fprintf(stderr, "FATAL: Cannot resize shared memory \"%s\" !\n", g_name);
+		close(fd);
+		shm_unlink(g_name);
+		return -1;
+	}
+
+	g_export = (shm_export_t *) mmap(NULL, sizeof(shm_export_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (g_export == MAP_FAILED) {
+		fprintf(stderr, "FATAL: Cannot map shared memory \"%s\" !\n", g_name);
+		g_export = NULL;
+		shm_unlink(g_name);
+		return -1;
+	}
+
+	memset(g_export, 0, sizeof(shm_export_t));
+	g_export->magic = SHM_EXPORT_MAGIC;
+	g_export->version = SHM_EXPORT_VERSION;
+
+	return 0;
+}
+
+void shm_export_update(bool_t matrix[LCD_HEIGHT][LCD_WIDTH], bool_t icons[ICON_NUM])
+{
+	state_t *state = tamalib_get_state();
+	u12_t i, j;
+
+	if (g_export == NULL) {
+		return;
+	}
+
+	/* Sequence lock (single writer) */
+	g_export->seq++;
+	SDL_MemoryBarrierRelease();
+
+	g_export->tick_counter = *(state->tick_counter);
+	g_export->pc = *(state->pc);
+	g_export->x = *(state->x);
+	g_export->y = *(state->y);
+	g_export->a = *(state->a);
+	g_export->b = *(state->b);
+	g_export->np = *(state->np);
+	g_export->sp = *(state->sp);
+	g_export->flags = *(state->flags);
+
+	for (i = 0; i < MEMORY_SIZE; i++) {
+		g_export->memory[i] = GET_MEMORY(state->memory, i);
+	}
+
+	for (j = 0; j < LCD_HEIGHT; j++) {
+		for (i = 0; i < LCD_WIDTH; i++) {
+			g_export->matrix[j][i] = matrix[j][i];
+		}
+	}
+
+	for (i = 0; i < ICON_NUM; i++) {
+		g_export->icons[i] = icons[i];
+	}
+
+	SDL_MemoryBarrierRelease();
+	g_export->seq++;
+}
+
+void shm_export_close(void)
+{
+	if (g_export == NULL) {
+		return;
+	}
+
+	munmap(g_export, sizeof(shm_export_t));
+	shm_unlink(g_name);
+	g_export = NULL;
+}
+#else
+#include <stdio.h>
+
+#include "lib/tamalib.h"
+
+#include "shm_export.h"
+
+int shm_export_open(char *name)
+{
+	fprintf(stderr, "FATAL: Shared memory export is not supported on this platform !\n");
+	return -1;
+}
+
+void shm_export_update(bool_t matrix[LCD_HEIGHT][LCD_WIDTH], bool_t icons[ICON_NUM]) {}
+void shm_export_close(void) {}
+#endif
@@ -0,0 +1,60 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _SHM_EXPORT_H_
+#define _SHM_EXPORT_H_
+
+#include <stdint.h>
+
+#include "lib/tamalib.h"
+
+#define SHM_EXPORT_MAGIC		0x4D534C54 // "TLSM" in little-endian
+#define SHM_EXPORT_VERSION		1
+
+/* Layout of the shared memory segment.
+ * Readers must use the sequence lock: read seq, wait while it is odd, copy
+ * the data, then read seq again and retry if it changed.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	volatile uint32_t seq; // Odd while an update is in progress
+
+	uint32_t tick_counter;
+	uint16_t pc;
+	uint16_t x;
+	uint16_t y;
+	uint8_t a;
+	uint8_t b;
+	uint8_t np;
+	uint8_t sp;
+	uint8_t flags;
+	uint8_t reserved;
+
+	uint8_t memory[MEMORY_SIZE]; // One nibble per byte
+	uint8_t matrix[LCD_HEIGHT][LCD_WIDTH];
+	uint8_t icons[ICON_NUM];
+} shm_export_t;
+
+
+int shm_export_open(char *name);
+void shm_export_update(bool_t matrix[LCD_HEIGHT][LCD_WIDTH], bool_t icons[ICON_NUM]);
+void shm_export_close(void);
+
+#endif /* _SHM_EXPORT_H_ */
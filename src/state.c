@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "SDL.h"
 
@@ -28,7 +29,10 @@
 #include "state.h"
 
 #define STATE_FILE_MAGIC				"TLST"
-#define STATE_FILE_VERSION				3
+#define STATE_FILE_VERSION				4
+
+/* Version 3 stored the tick counter and the timer timestamps as u32 */
+#define STATE_FILE_MIN_VERSION				3
 
 #define STATE_TEMPLATE					"%s_save%u.bin"
 
@@ -64,7 +68,34 @@ void state_find_last_name(char *path, char *rom_name)
 	}
 }
 
-void state_save(char *path)
+static uint32_t write_timestamp(SDL_RWops *f, uint64_t ts)
+{
+	uint8_t buf[8];
+	uint32_t i;
+
+	for (i = 0; i < 8; i++) {
+		buf[i] = (ts >> (8 * i)) & 0xFF;
+	}
+
+	return SDL_RWwrite(f, buf, 8, 1);
+}
+
+static uint32_t read_timestamp(SDL_RWops *f, uint32_t size, uint64_t *ts)
+{
+	uint8_t buf[8];
+	uint32_t i, num;
+
+	num = SDL_RWread(f, buf, size, 1);
+
+	*ts = 0;
+	for (i = 0; i < size; i++) {
+		*ts |= (uint64_t) buf[i] << (8 * i);
+	}
+
+	return num;
+}
+
+int state_save(char *path)
 {
 	SDL_RWops *f;
 	state_t *state;
@@ -77,12 +108,13 @@ void state_save(char *path)
 	f = SDL_RWFromFile(path, "w");
 	if (f == NULL) {
 		fprintf(stderr, "FATAL: Cannot create state file \"%s\" !\n", path);
-		return;
+		return -1;
 	}
 
 	/* First the magic, then the version, and finally the fields of
 	 * the state_t struct written as u8, u16 little-endian or u32
-	 * little-endian following the struct order
+	 * little-endian following the struct order (the tick counter and
+	 * the timer timestamps are written as u64 little-endian)
 	 */
 	buf[0] = (uint8_t) STATE_FILE_MAGIC[0];
 	buf[1] = (uint8_t) STATE_FILE_MAGIC[1];
@@ -120,65 +152,25 @@ void state_save(char *path)
 	buf[0] = *(state->flags) & 0xF;
 	num += SDL_RWwrite(f, buf, 1, 1);
 
-	buf[0] = *(state->tick_counter) & 0xFF;
-	buf[1] = (*(state->tick_counter) >> 8) & 0xFF;
-	buf[2] = (*(state->tick_counter) >> 16) & 0xFF;
-	buf[3] = (*(state->tick_counter) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->tick_counter));
 
-	buf[0] = *(state->clk_timer_2hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_2hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_2hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_2hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_2hz_timestamp));
 
-	buf[0] = *(state->clk_timer_4hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_4hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_4hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_4hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_4hz_timestamp));
 
-	buf[0] = *(state->clk_timer_8hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_8hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_8hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_8hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_8hz_timestamp));
 
-	buf[0] = *(state->clk_timer_16hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_16hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_16hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_16hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_16hz_timestamp));
 
-	buf[0] = *(state->clk_timer_32hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_32hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_32hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_32hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_32hz_timestamp));
 
-	buf[0] = *(state->clk_timer_64hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_64hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_64hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_64hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_64hz_timestamp));
 
-	buf[0] = *(state->clk_timer_128hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_128hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_128hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_128hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_128hz_timestamp));
 
-	buf[0] = *(state->clk_timer_256hz_timestamp) & 0xFF;
-	buf[1] = (*(state->clk_timer_256hz_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->clk_timer_256hz_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->clk_timer_256hz_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->clk_timer_256hz_timestamp));
 
-	buf[0] = *(state->prog_timer_timestamp) & 0xFF;
-	buf[1] = (*(state->prog_timer_timestamp) >> 8) & 0xFF;
-	buf[2] = (*(state->prog_timer_timestamp) >> 16) & 0xFF;
-	buf[3] = (*(state->prog_timer_timestamp) >> 24) & 0xFF;
-	num += SDL_RWwrite(f, buf, 4, 1);
+	num += write_timestamp(f, *(state->prog_timer_timestamp));
 
 	buf[0] = *(state->prog_timer_enabled) & 0x1;
 	num += SDL_RWwrite(f, buf, 1, 1);
@@ -218,47 +210,55 @@ void state_save(char *path)
 		num += SDL_RWwrite(f, buf, 1, 1);
 	}
 
-	if (num != (24 + INT_SLOT_NUM * 3 + MEM_RAM_SIZE + MEM_IO_SIZE)) {
+	/* Pending data is only written when closing */
+	if (SDL_RWclose(f) < 0 || num != (24 + INT_SLOT_NUM * 3 + MEM_RAM_SIZE + MEM_IO_SIZE)) {
 		fprintf(stderr, "FATAL: Failed to write to state file \"%s\" %u %u !\n", path, num, (23 + INT_SLOT_NUM * 3 + MEMORY_SIZE));
+		return -1;
 	}
 
-	SDL_RWclose(f);
+	return 0;
 }
 
-void state_load(char *path)
+int state_load(char *path)
 {
 	SDL_RWops *f;
 	state_t *state;
 	uint8_t buf[4];
 	uint32_t num = 0;
 	uint32_t i;
+	uint32_t timestamp_size;
+	uint64_t ts;
 
 	state = tamalib_get_state();
 
 	f = SDL_RWFromFile(path, "r");
 	if (f == NULL) {
 		fprintf(stderr, "FATAL: Cannot open state file \"%s\" !\n", path);
-		return;
+		return -1;
 	}
 
 	/* First the magic, then the version, and finally the fields of
 	 * the state_t struct written as u8, u16 little-endian or u32
-	 * little-endian following the struct order
+	 * little-endian following the struct order (the tick counter and
+	 * the timer timestamps are written as u64 little-endian)
 	 */
 	num += SDL_RWread(f, buf, 4, 1);
 	if (buf[0] != (uint8_t) STATE_FILE_MAGIC[0] || buf[1] != (uint8_t) STATE_FILE_MAGIC[1] ||
 		buf[2] != (uint8_t) STATE_FILE_MAGIC[2] || buf[3] != (uint8_t) STATE_FILE_MAGIC[3]) {
 		fprintf(stderr, "FATAL: Wrong state file magic in \"%s\" !\n", path);
-		return;
+		SDL_RWclose(f);
+		return -1;
 	}
 
 	num += SDL_RWread(f, buf, 1, 1);
-	if (buf[0] != STATE_FILE_VERSION) {
-		fprintf(stderr, "FATAL: Unsupported version %u (expected %u) in state file \"%s\" !\n", buf[0], STATE_FILE_VERSION, path);
-		/* TODO: Handle migration at a point */
-		return;
+	if (buf[0] < STATE_FILE_MIN_VERSION || buf[0] > STATE_FILE_VERSION) {
+		fprintf(stderr, "FATAL: Unsupported version %u (expected %u to %u) in state file \"%s\" !\n", buf[0], STATE_FILE_MIN_VERSION, STATE_FILE_VERSION, path);
+		SDL_RWclose(f);
+		return -1;
 	}
 
+	timestamp_size = (buf[0] == 3) ? 4 : 8;
+
 	num += SDL_RWread(f, buf, 2, 1);
 	*(state->pc) = buf[0] | ((buf[1] & 0x1F) << 8);
 
@@ -283,35 +283,35 @@ void state_load(char *path)
 	num += SDL_RWread(f, buf, 1, 1);
 	*(state->flags) = buf[0] & 0xF;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->tick_counter) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->tick_counter) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_2hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_2hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_4hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_4hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_8hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_8hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_16hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_16hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_32hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_32hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_64hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_64hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_128hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_128hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->clk_timer_256hz_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->clk_timer_256hz_timestamp) = ts;
 
-	num += SDL_RWread(f, buf, 4, 1);
-	*(state->prog_timer_timestamp) = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	num += read_timestamp(f, timestamp_size, &ts);
+	*(state->prog_timer_timestamp) = ts;
 
 	num += SDL_RWread(f, buf, 1, 1);
 	*(state->prog_timer_enabled) = buf[0] & 0x1;
@@ -348,11 +348,94 @@ void state_load(char *path)
 		SET_IO_MEMORY(state->memory, i + MEM_IO_ADDR, buf[0] & 0xF);
 	}
 
+	SDL_RWclose(f);
+
+	tamalib_refresh_hw();
+
 	if (num != (24 + INT_SLOT_NUM * 3 + MEM_RAM_SIZE + MEM_IO_SIZE)) {
 		fprintf(stderr, "FATAL: Failed to read from state file \"%s\" !\n", path);
+		return -1;
 	}
 
-	SDL_RWclose(f);
+	return 0;
+}
+
+/* In-memory snapshots are raw copies of the state_t fields, including
+ * the whole memory, so that they are exact and cheap to swap. They are
+ * only valid for the running TamaLIB build.
+ *
+ * TamaLIB has no API for its other internals, which are assumed to carry
+ * nothing specific to a pet between two instructions:
+ * - the pacing reference, unused as the speed is set to 0
+ * - the execution mode and the stepping depth of the debugger, both
+ *   only used with a single pet
+ * - the cycles of the last instruction, charged to the tick counter when
+ *   the next step begins: the first instruction run after a swap is off
+ *   by a few ticks at most
+ * The LCD and buzzer outputs live in the pets, and are rewritten from the
+ * I/O registers by tamalib_refresh_hw() after each swap.
+ */
+static uint32_t snapshot_copy(uint8_t *buf, bool_t save)
+{
+	state_t *state = tamalib_get_state();
+	uint32_t offset = 0;
+
+#define SNAPSHOT_COPY(ptr, size)	{ \
+						if (buf != NULL) { \
+							if (save) { \
+								memcpy(buf + offset, (ptr), (size)); \
+							} else { \
+								memcpy((ptr), buf + offset, (size)); \
+							} \
+						} \
+						offset += (size); \
+					}
+#define SNAPSHOT_FIELD(f)		SNAPSHOT_COPY(state->f, sizeof(*(state->f)))
+
+	SNAPSHOT_FIELD(pc);
+	SNAPSHOT_FIELD(x);
+	SNAPSHOT_FIELD(y);
+	SNAPSHOT_FIELD(a);
+	SNAPSHOT_FIELD(b);
+	SNAPSHOT_FIELD(np);
+	SNAPSHOT_FIELD(sp);
+	SNAPSHOT_FIELD(flags);
+	SNAPSHOT_FIELD(tick_counter);
+	SNAPSHOT_FIELD(clk_timer_2hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_4hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_8hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_16hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_32hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_64hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_128hz_timestamp);
+	SNAPSHOT_FIELD(clk_timer_256hz_timestamp);
+	SNAPSHOT_FIELD(prog_timer_timestamp);
+	SNAPSHOT_FIELD(prog_timer_enabled);
+	SNAPSHOT_FIELD(prog_timer_data);
+	SNAPSHOT_FIELD(prog_timer_rld);
+	SNAPSHOT_FIELD(call_depth);
+	SNAPSHOT_COPY(state->interrupts, INT_SLOT_NUM * sizeof(interrupt_t));
+	SNAPSHOT_COPY(state->memory, MEM_BUFFER_SIZE * sizeof(*(state->memory)));
+
+#undef SNAPSHOT_FIELD
+#undef SNAPSHOT_COPY
+
+	return offset;
+}
+
+uint32_t state_snapshot_size(void)
+{
+	return snapshot_copy(NULL, 0);
+}
+
+void state_snapshot_save(uint8_t *buf)
+{
+	snapshot_copy(buf, 1);
+}
+
+void state_snapshot_load(uint8_t *buf)
+{
+	snapshot_copy(buf, 0);
 
 	tamalib_refresh_hw();
 }
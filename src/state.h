@@ -20,10 +20,14 @@
 #ifndef _STATE_H_
 #define _STATE_H_
 
+#include <stdint.h>
 
 void state_find_next_name(char *path, char *rom_name);
 void state_find_last_name(char *path, char *rom_name);
-void state_save(char *path);
-void state_load(char *path);
+int state_save(char *path);
+int state_load(char *path);
+uint32_t state_snapshot_size(void);
+void state_snapshot_save(uint8_t *buf);
+void state_snapshot_load(uint8_t *buf);
 
 #endif /* _STATE_H_ */
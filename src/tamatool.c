@@ -24,9 +24,13 @@
 #include <string.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <signal.h>
 #if !defined(__WIN32__)
 #include <time.h>
 #endif
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
 
 #if defined(__WIN32__)
 #include <windows.h>
@@ -40,8 +44,19 @@
 #include "lib/tamalib.h"
 
 #include "program.h"
+#include "image.h"
 #include "state.h"
+#include "pet.h"
 #include "mem_edit.h"
+#include "watch.h"
+#include "shm_export.h"
+#include "trace.h"
+#include "async_log.h"
+#include "log_window.h"
+#include "input_script.h"
+#include "breakpoint.h"
+#include "gdb_stub.h"
+#include "fleet.h"
 
 #define APP_NAME			"TamaTool"
 #define APP_VERSION			"1.0" // Major, minor
@@ -50,6 +65,8 @@
 
 #define ROM_PATH			"rom.bin"
 
+#define SPRITE_INDEX_TEMPLATE		"%s.idx" // Next to the PNG file, the ROM folder might be read-only
+
 #define ROM_NOT_FOUND_TITLE		"Tamagotchi ROM not found"
 #define ROM_NOT_FOUND_MSG		"You need to place a Tamagotchi ROM called \"rom.bin\" inside TamaTool's folder/package first !"
 
@@ -97,28 +114,93 @@
 #define AUDIO_VOLUME			0.2f
 
 #define MEM_FRAMERATE			30 // fps
+#define FRAMERATE			30 // fps
+#define DEFAULT_EXPORT_RATE		10 // Hz
+#define EXPORT_RATE_MAX			1000 // Hz
+#define GDB_POLL_RATE			100 // Hz
+
+#define TICK_RATE			32768 // Hz, emulated
 
-/* Uncomment this line to be as close as possible
- * to a cycle-accurate emulation. The downside is that
- * the CPU load will be close to 100%.
+#define STRINGIFY(x)			#x
+#define STR(x)				STRINGIFY(x)
+
+/* Uncomment this line to busy-wait by default (see --timing) to be
+ * as close as possible to a cycle-accurate emulation. The downside is
+ * that the CPU load will be close to 100%.
  */
 //#define NO_SLEEP
 
+#define HYBRID_INITIAL_OVERSHOOT	100 // us
+#define HYBRID_MIN_OVERSHOOT		10 // us
+#define HYBRID_MARGIN			20 // us
+
+/* Long options without a short equivalent */
+enum {
+	OPT_PACKED = 256,
+	OPT_PNG_FILTER,
+	OPT_WATCH_LOG,
+	OPT_EXPORT_RATE,
+	OPT_LOG_START,
+	OPT_LOG_STOP,
+	OPT_LOG_TICKS,
+	OPT_TIMING,
+	OPT_TRACE_SIZE,
+};
+
 typedef enum {
-	SPEED_UNLIMITED = 0,
-	SPEED_1X = 1,
-	SPEED_10X = 10,
-} emulation_speed_t;
+	TIMING_SLEEP = 0,
+	TIMING_SPIN,
+	TIMING_HYBRID,
+} timing_mode_t;
 
-static breakpoint_t *g_breakpoints = NULL;
+#define SPEED_UNLIMITED			0
+#define SPEED_MIN			0.1
+#define SPEED_MAX			1000
+
+#define AGE_HOURS_MAX			1000000 // More than a century
+
+#define PACE_MAX_LAG			100000 // us, the pace is reset past that point (pause, slow host)
+
+#define PET_SLICE_TICKS			(TICK_RATE/32) // Emulated time a pet runs for before the next one takes its turn
 
 static u12_t *g_program = NULL;		// The actual program that is executed
 static uint32_t g_program_size = 0;
+static bool_t g_program_shared = 0;	// The program is a read-only mapping shared between instances
 
 static char rom_basename[256] = "";
 static char* rom_type = NULL;
 
 static bool_t memory_editor_enable = 0;
+static bool_t headless = 0;
+static volatile sig_atomic_t quit_requested = 0;
+static bool_t age_enable = 0;
+static uint64_t age_ticks = 0; // Emulated duration to run for
+
+#ifdef NO_SLEEP
+static timing_mode_t timing_mode = TIMING_SPIN;
+#else
+static timing_mode_t timing_mode = TIMING_SLEEP;
+#endif
+static timestamp_diff_t sleep_overshoot = HYBRID_INITIAL_OVERSHOOT; // Estimated, in us
+
+/* Time derived from the emulated cycles instead of the host clock */
+static bool_t virtual_clock = 0;
+static bool_t virtual_clock_started = 0;
+
+/* Emulated ticks since the start, the tick counter being only 32-bit */
+static uint64_t total_ticks = 0;
+static u32_t total_last_tick = 0;
+
+/* Reference points of the emulation pace */
+static timestamp_t pace_ts = 0;
+static uint64_t pace_ticks = 0;
+static bool_t watch_enable = 0;
+static bool_t export_enable = 0;
+static bool_t trace_enable = 0;
+static bool_t gdb_enable = 0;
+static bool_t record_enable = 0;
+static bool_t play_enable = 0;
+static uint32_t export_rate = DEFAULT_EXPORT_RATE;
 
 static SDL_Window *window = NULL;
 static SDL_Renderer* renderer = NULL;
@@ -134,15 +216,26 @@ static SDL_AudioDeviceID audio_dev;
 static u32_t current_freq = 0; // in dHz
 static unsigned int sin_pos = 0;
 static bool_t is_audio_playing = 0;
+static bool_t requested_audio_playing = 0;
 
-static bool_t matrix_buffer[LCD_HEIGHT][LCD_WIDTH] = {{0}};
-static bool_t icon_buffer[ICON_NUM] = {0};
+static pet_t pets[PET_MAX];
+static uint32_t pet_num = 1;
+static pet_t *running_pet = &pets[0]; // Pet whose state is in TamaLIB
+static pet_t *shown_pet = &pets[0]; // Pet rendered and receiving the inputs
+static uint64_t slice_start_ticks = 0;
+static pet_t fleet_boot_pet; // Initial state of the fleet pets, before loading their save
 
 static u8_t log_levels = LOG_ERROR | LOG_INFO;
+static bool_t async_log_enable = 0;
+static bool_t log_window_enable = 0;
+static u8_t log_window_levels = 0; // Levels only enabled inside the trace windows
 
-static emulation_speed_t speed = SPEED_1X;
+static double speed = 1; // SPEED_UNLIMITED or SPEED_MIN to SPEED_MAX
 
 static timestamp_t mem_dump_ts = 0;
+static timestamp_t screen_ts = 0;
+static timestamp_t export_ts = 0;
+static timestamp_t gdb_ts = 0;
 
 static uint16_t pixel_stride = DEFAULT_PIXEL_STRIDE;
 static uint16_t shell_width, shell_height, bg_offset_x, bg_offset_y; // Offsets are relative to the shell (0, 0)
@@ -159,6 +252,18 @@ static void sdl_release(void);
 static bool_t sdl_init(void);
 
 
+static void free_program(void)
+{
+	if (g_program_shared) {
+		program_unshare(g_program, g_program_size);
+	} else {
+		SDL_free(g_program);
+	}
+
+	g_program = NULL;
+}
+
+
 static void * hal_malloc(u32_t size)
 {
 	return SDL_malloc(size);
@@ -171,6 +276,7 @@ static void hal_free(void *ptr)
 
 static void hal_halt(void)
 {
+	async_log_stop();
 	exit(EXIT_SUCCESS);
 }
 
@@ -189,49 +295,230 @@ static void hal_log(log_level_t level, char *buff, ...)
 
 	va_start(arglist, buff);
 
-	vfprintf((level == LOG_ERROR) ? stderr : stdout, buff, arglist);
+	if (async_log_enable) {
+		/* Formatting and I/O are done by the logging thread, which also
+		 * keeps the order of the lines
+		 */
+		async_log_push((level == LOG_ERROR) ? stderr : stdout, buff, arglist);
+	} else {
+		vfprintf((level == LOG_ERROR) ? stderr : stdout, buff, arglist);
+	}
 
 	va_end(arglist);
 }
 
-static timestamp_t hal_get_timestamp(void)
+static uint64_t update_total_ticks(void)
+{
+	u32_t tick = *(tamalib_get_state()->tick_counter);
+
+	total_ticks += (u32_t) (tick - total_last_tick);
+	total_last_tick = tick;
+
+	return total_ticks;
+}
+
+/* Must be called when the tick counter is modified (state loading),
+ * the emulated time going on from where it was
+ */
+static void sync_total_ticks(void)
+{
+	total_last_tick = *(tamalib_get_state()->tick_counter);
+}
+
+static timestamp_t get_virtual_timestamp(void)
+{
+	/* The CPU state is only valid once TamaLIB is initialized */
+	if (!virtual_clock_started) {
+		return 0;
+	}
+
+	return (timestamp_t) (update_total_ticks() * 1000000 / TICK_RATE);
+}
+
+/* Wall clock, used for pacing and for everything related to the host
+ * (rendering, polling...), whatever the emulation clock is
+ */
+static timestamp_t get_host_timestamp(void)
 {
 #if defined(__WIN32__)
 	LARGE_INTEGER count;
 
 	QueryPerformanceCounter(&count);
-	return (count.QuadPart * 1000000)/counter_freq.QuadPart;
+	return (timestamp_t) ((count.QuadPart / counter_freq.QuadPart) * 1000000 + ((count.QuadPart % counter_freq.QuadPart) * 1000000)/counter_freq.QuadPart);
 #else
 	struct timespec time;
 
-	clock_gettime(CLOCK_REALTIME, &time);
-	return (time.tv_sec * 1000000 + time.tv_nsec/1000);
+	/* Not affected by NTP or DST adjustments */
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return ((timestamp_t) time.tv_sec * 1000000 + time.tv_nsec/1000);
 #endif
 }
 
-static void hal_sleep_until(timestamp_t ts)
+static timestamp_t hal_get_timestamp(void)
+{
+	if (virtual_clock) {
+		return get_virtual_timestamp();
+	}
+
+	return get_host_timestamp();
+}
+
+static void sleep_for(timestamp_diff_t us)
 {
-#ifndef NO_SLEEP
 #if defined(__WIN32__)
-	/* Sleep for 1 ms from time to time */
-	while ((int32_t) (ts - hal_get_timestamp()) > 0) Sleep(1);
+	if (us >= 1000) {
+		Sleep(us / 1000);
+	}
 #else
 	struct timespec t;
-	int32_t remaining = (int32_t) (ts - hal_get_timestamp());
 
-	/* Sleep for a bit more than what is needed */
-	if (remaining > 0) {
-		t.tv_sec = remaining / 1000000;
-		t.tv_nsec = (remaining % 1000000) * 1000;
+	if (us > 0) {
+		t.tv_sec = us / 1000000;
+		t.tv_nsec = (us % 1000000) * 1000;
 		nanosleep(&t, NULL);
 	}
 #endif
+}
+
+/* Sleeps for most of the interval, keeping the host's typical sleep
+ * overshoot as margin, then spins until the deadline
+ */
+static void hybrid_wait_until(timestamp_t ts)
+{
+	timestamp_t before;
+	timestamp_diff_t remaining, request, overshoot;
+
+	before = get_host_timestamp();
+	remaining = (timestamp_diff_t) (ts - before);
+	request = remaining - sleep_overshoot - HYBRID_MARGIN;
+
+	if (request > 0) {
+		sleep_for(request);
+
+		/* Exponential moving average of the measured overshoot */
+		overshoot = (timestamp_diff_t) (get_host_timestamp() - before) - request;
+		sleep_overshoot += (overshoot - sleep_overshoot) / 8;
+		if (sleep_overshoot < HYBRID_MIN_OVERSHOOT) {
+			sleep_overshoot = HYBRID_MIN_OVERSHOOT;
+		}
+	}
+
+	while ((timestamp_diff_t) (ts - get_host_timestamp()) > 0);
+}
+
+/* Only used for pacing, never on the virtual clock */
+static void hal_sleep_until(timestamp_t ts)
+{
+	switch (timing_mode) {
+		case TIMING_SLEEP:
+#if defined(__WIN32__)
+			/* Sleep for 1 ms from time to time */
+			while ((timestamp_diff_t) (ts - get_host_timestamp()) > 0) Sleep(1);
 #else
-	/* Wait instead of sleeping to get the highest possible accuracy
-	 * NOTE: the accuracy still depends on the timestamp_t resolution.
-	 */
-	while ((int32_t) (ts - hal_get_timestamp()) > 0);
+			/* Sleep for a bit more than what is needed */
+			sleep_for((timestamp_diff_t) (ts - get_host_timestamp()));
 #endif
+			break;
+
+		case TIMING_SPIN:
+			/* Wait instead of sleeping to get the highest possible accuracy
+			 * NOTE: the accuracy still depends on the timestamp_t resolution.
+			 */
+			while ((timestamp_diff_t) (ts - get_host_timestamp()) > 0);
+			break;
+
+		case TIMING_HYBRID:
+			hybrid_wait_until(ts);
+			break;
+	}
+}
+
+/* Must be called when the emulation did not run for a while */
+static void reset_pace(void)
+{
+	pace_ts = get_host_timestamp();
+	pace_ticks = update_total_ticks();
+}
+
+/* Keeps the emulated time at speed times the wall time, instead of
+ * letting TamaLIB wait, since it only supports integer ratios
+ */
+static void pace(void)
+{
+	timestamp_t target;
+	timestamp_diff_t ahead;
+
+	/* The pets share the emulated ticks */
+	target = pace_ts + (timestamp_t) ((update_total_ticks() - pace_ticks) * (1000000 / (TICK_RATE * speed * pet_num)));
+	ahead = (timestamp_diff_t) (target - get_host_timestamp());
+
+	if (ahead > 0) {
+		hal_sleep_until(target);
+	} else if (ahead < -PACE_MAX_LAG) {
+		/* Do not try to catch up after a pause */
+		reset_pace();
+	}
+}
+
+static void set_speed(double s)
+{
+	if (s != SPEED_UNLIMITED) {
+		s = (s < SPEED_MIN) ? SPEED_MIN : ((s > SPEED_MAX) ? SPEED_MAX : s);
+	}
+
+	speed = s;
+	reset_pace();
+
+	if (speed == SPEED_UNLIMITED) {
+		hal_log(LOG_INFO, "Speed: unlimited\n");
+	} else {
+		hal_log(LOG_INFO, "Speed: x%g\n", speed);
+	}
+}
+
+static uint64_t get_pet_ticks(pet_t *pet)
+{
+	if (pet == running_pet) {
+		return pet->ticks + update_total_ticks() - slice_start_ticks;
+	}
+
+	return pet->ticks;
+}
+
+/* Next pet to run, NULL if they are all done */
+static pet_t * next_pet(void)
+{
+	pet_t *pet;
+	uint32_t i;
+
+	for (i = 1; i <= pet_num; i++) {
+		pet = &pets[(running_pet - pets + i) % pet_num];
+		if (!pet->done) {
+			return pet;
+		}
+	}
+
+	return NULL;
+}
+
+/* Starts a new slice, with the given pet loaded into TamaLIB */
+static void switch_pet(pet_t *pet)
+{
+	uint64_t ticks = update_total_ticks();
+
+	running_pet->ticks += ticks - slice_start_ticks;
+	slice_start_ticks = ticks;
+
+	if (pet == running_pet) {
+		return;
+	}
+
+	pet_swap_out(running_pet);
+	running_pet = pet;
+	pet_swap_in(running_pet);
+
+	/* The tick counter belongs to the pet */
+	sync_total_ticks();
 }
 
 static void hal_update_screen(void)
@@ -239,6 +526,11 @@ static void hal_update_screen(void)
 	unsigned int i, j;
 	SDL_Rect r, src_icon_r, dest_icon_r;
 
+	if (headless) {
+		/* The LCD state is still available in the pet */
+		return;
+	}
+
 	if (bg != NULL) {
 		SDL_RenderCopy(renderer, bg, NULL, &bg_rect);
 	} else {
@@ -254,7 +546,7 @@ static void hal_update_screen(void)
 			r.x = i * pixel_stride + lcd_offset_x + bg_offset_x;
 			r.y = j * pixel_stride + lcd_offset_y + bg_offset_y;
 
-			if (matrix_buffer[j][i]) {
+			if (shown_pet->matrix[j][i]) {
 				SDL_SetRenderDrawColor(renderer, 0, 0, 128, pixel_alpha_on);
 			} else {
 				SDL_SetRenderDrawColor(renderer, 0, 0, 128, pixel_alpha_off);
@@ -278,7 +570,7 @@ static void hal_update_screen(void)
 
 
 		SDL_SetTextureColorMod(icons, 0, 0, 128);
-		if (icon_buffer[i]) {
+		if (shown_pet->icons[i]) {
 			SDL_SetTextureAlphaMod(icons, icon_alpha_on);
 		} else {
 			SDL_SetTextureAlphaMod(icons, icon_alpha_off);
@@ -294,17 +586,20 @@ static void hal_update_screen(void)
 
 static void hal_set_lcd_matrix(u8_t x, u8_t y, bool_t val)
 {
-	matrix_buffer[y][x] = val;
+	running_pet->matrix[y][x] = val;
 }
 
 static void hal_set_lcd_icon(u8_t icon, bool_t val)
 {
-	icon_buffer[icon] = val;
+	running_pet->icons[icon] = val;
 }
 
 static void hal_set_frequency(u32_t freq)
 {
-	if (current_freq != freq) {
+	running_pet->freq = freq;
+
+	/* Only the shown pet is heard */
+	if (running_pet == shown_pet && current_freq != freq) {
 		current_freq = freq;
 		sin_pos = 0;
 	}
@@ -312,7 +607,16 @@ static void hal_set_frequency(u32_t freq)
 
 static void hal_play_frequency(bool_t en)
 {
-	if (is_audio_playing != en) {
+	running_pet->buzzer = en;
+
+	if (running_pet != shown_pet) {
+		return;
+	}
+
+	requested_audio_playing = en;
+
+	/* Otherwise applied at the screen refresh rate */
+	if (speed == 1 && is_audio_playing != en) {
 		is_audio_playing = en;
 	}
 }
@@ -359,23 +663,37 @@ static void compute_layout(void)
 	buttons_height = (lcd_size * REF_BUTTONS_HEIGHT)/REF_LCD_SIZE;
 }
 
+static void set_button(button_t btn, btn_state_t state)
+{
+	/* Reacting right away, rather than at its next turn */
+	if (running_pet != shown_pet) {
+		switch_pet(shown_pet);
+	}
+
+	if (record_enable) {
+		input_script_record(update_total_ticks(), btn, state);
+	}
+
+	tamalib_set_button(btn, state);
+}
+
 static void handle_click(int32_t x, int32_t y, uint8_t pressed) {
 	if (y >= buttons_y && y < buttons_y + buttons_height) {
 		if (x < buttons_x) {
 			/* Nothing */
 		} else if (x < buttons_x + buttons_width/3) {
 			/* Left button */
-			tamalib_set_button(BTN_LEFT, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
+			set_button(BTN_LEFT, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
 		} else if (x < buttons_x + (buttons_width * 2)/3) {
 			/* Middle button */
-			tamalib_set_button(BTN_MIDDLE, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
+			set_button(BTN_MIDDLE, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
 		} else if (x < buttons_x + buttons_width) {
 			/* Right button */
-			tamalib_set_button(BTN_RIGHT, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
+			set_button(BTN_RIGHT, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
 		}
 	} else if (x >= bg_offset_x && x < bg_offset_x + bg_size && y >= bg_offset_y && y < bg_offset_y + bg_size) {
 		/* Tap sensor */
-		tamalib_set_button(BTN_TAP, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
+		set_button(BTN_TAP, pressed ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
 	}
 }
 
@@ -456,24 +774,42 @@ static int handle_sdl_events(SDL_Event *event)
 					break;
 
 				case SDLK_f:
-					switch (speed) {
-						case SPEED_1X:
-							speed = SPEED_10X;
-							break;
-
-						case SPEED_10X:
-							speed = SPEED_UNLIMITED;
-							break;
-
-						case SPEED_UNLIMITED:
-							speed = SPEED_1X;
-							break;
+					/* 1x -> 10x -> unlimited -> 1x */
+					if (speed == SPEED_UNLIMITED) {
+						set_speed(1);
+					} else if (speed < 10) {
+						set_speed(10);
+					} else {
+						set_speed(SPEED_UNLIMITED);
+					}
+					break;
+
+				case SDLK_PLUS:
+				case SDLK_EQUALS:
+				case SDLK_KP_PLUS:
+					if (speed != SPEED_UNLIMITED) {
+						set_speed(speed * 2);
 					}
+					break;
+
+				case SDLK_MINUS:
+				case SDLK_KP_MINUS:
+					set_speed((speed == SPEED_UNLIMITED) ? SPEED_MAX : speed / 2);
+					break;
 
-					tamalib_set_speed((u8_t) speed);
+				case SDLK_TAB:
+					if (pet_num > 1) {
+						shown_pet = &pets[(shown_pet - pets + 1) % pet_num];
+						current_freq = shown_pet->freq;
+						sin_pos = 0;
+						requested_audio_playing = shown_pet->buzzer;
+						is_audio_playing = shown_pet->buzzer;
+						hal_log(LOG_INFO, "Showing pet %u/%u\n", (unsigned int) (shown_pet - pets) + 1, pet_num);
+					}
 					break;
 
 				case SDLK_b:
+					switch_pet(shown_pet);
 					state_find_next_name(save_path, rom_basename);
 					state_save(save_path);
 					break;
@@ -481,7 +817,14 @@ static int handle_sdl_events(SDL_Event *event)
 				case SDLK_n:
 					state_find_last_name(save_path, rom_basename);
 					if (save_path[0]) {
+						switch_pet(shown_pet);
 						state_load(save_path);
+						sync_total_ticks();
+						reset_pace();
+
+						if (watch_enable) {
+							watch_request_scan();
+						}
 					}
 					break;
 
@@ -515,19 +858,19 @@ static int handle_sdl_events(SDL_Event *event)
 					break;
 
 				case SDLK_LEFT:
-					tamalib_set_button(BTN_LEFT, BTN_STATE_PRESSED);
+					set_button(BTN_LEFT, BTN_STATE_PRESSED);
 					break;
 
 				case SDLK_DOWN:
-					tamalib_set_button(BTN_MIDDLE, BTN_STATE_PRESSED);
+					set_button(BTN_MIDDLE, BTN_STATE_PRESSED);
 					break;
 
 				case SDLK_RIGHT:
-					tamalib_set_button(BTN_RIGHT, BTN_STATE_PRESSED);
+					set_button(BTN_RIGHT, BTN_STATE_PRESSED);
 					break;
 
 				case SDLK_SPACE:
-					tamalib_set_button(BTN_TAP, BTN_STATE_PRESSED);
+					set_button(BTN_TAP, BTN_STATE_PRESSED);
 					break;
 			}
 			break;
@@ -535,19 +878,19 @@ static int handle_sdl_events(SDL_Event *event)
 		case SDL_KEYUP:
 			switch (event->key.keysym.sym) {
 				case SDLK_LEFT:
-					tamalib_set_button(BTN_LEFT, BTN_STATE_RELEASED);
+					set_button(BTN_LEFT, BTN_STATE_RELEASED);
 					break;
 
 				case SDLK_DOWN:
-					tamalib_set_button(BTN_MIDDLE, BTN_STATE_RELEASED);
+					set_button(BTN_MIDDLE, BTN_STATE_RELEASED);
 					break;
 
 				case SDLK_RIGHT:
-					tamalib_set_button(BTN_RIGHT, BTN_STATE_RELEASED);
+					set_button(BTN_RIGHT, BTN_STATE_RELEASED);
 					break;
 
 				case SDLK_SPACE:
-					tamalib_set_button(BTN_TAP, BTN_STATE_RELEASED);
+					set_button(BTN_TAP, BTN_STATE_RELEASED);
 					break;
 			}
 			break;
@@ -570,6 +913,10 @@ static int hal_handler(void)
 		}
 	}
 
+	if (headless) {
+		return quit_requested;
+	}
+
 	while (SDL_PollEvent(&event)) {
 		if (handle_sdl_events(&event)) {
 			return 1;
@@ -595,6 +942,193 @@ static hal_t hal = {
 	.handler = &hal_handler,
 };
 
+static void quit_signal_handler(int sig)
+{
+	quit_requested = 1;
+}
+
+static void stop_execution(void)
+{
+	tamalib_set_exec_mode(EXEC_MODE_PAUSE);
+
+	if (gdb_enable) {
+		gdb_stub_notify_stop();
+	}
+}
+
+static void mainloop(void)
+{
+	state_t *state = tamalib_get_state();
+	timestamp_t ts;
+	u13_t pc;
+	u32_t tick;
+	bool_t wp_hit, executed, moved;
+	bool_t halted = 0;
+
+	slice_start_ticks = update_total_ticks();
+	reset_pace();
+
+	while (!hal_handler()) {
+		pc = *(state->pc);
+
+		if (log_window_enable) {
+			if (log_window_check(pc, *(state->tick_counter))) {
+				log_levels |= log_window_levels;
+			} else {
+				log_levels &= ~log_window_levels;
+			}
+		}
+
+		/* Memory accesses are decoded from the instruction about to be executed */
+		wp_hit = (wp_get_num() || watch_enable) && wp_match(g_program[pc]);
+
+		if (play_enable) {
+			input_script_play(update_total_ticks());
+		}
+
+		tick = *(state->tick_counter);
+
+		tamalib_step();
+
+		/* Nothing is executed while paused, and ticks elapse without
+		 * executing anything while halted (HALT or SLP), until an interrupt
+		 * moves the PC. Comparing PCs alone would miss an instruction
+		 * jumping to itself. An interrupt serviced right after HALT or SLP
+		 * moves the PC to its vector, the CPU then running the handler.
+		 */
+		executed = (*(state->tick_counter) != tick) && !halted;
+		moved = executed || (*(state->pc) != pc);
+		if (halted) {
+			halted = (*(state->pc) == pc);
+		} else if (executed) {
+			halted = (g_program[pc] == 0xFF8 || g_program[pc] == 0xFF9) && *(state->pc) == ((pc + 1) & 0x1FFF);
+		}
+
+		if (log_window_enable && executed) {
+			log_window_executed(pc);
+		}
+
+		if (age_enable && get_pet_ticks(running_pet) >= age_ticks) {
+			running_pet->done = 1;
+			if (next_pet() == NULL) {
+				break;
+			}
+
+			switch_pet(next_pet());
+		} else if (pet_num > 1 && update_total_ticks() - slice_start_ticks >= PET_SLICE_TICKS) {
+			switch_pet(next_pet());
+		}
+
+		if (speed != SPEED_UNLIMITED && !virtual_clock) {
+			pace();
+		}
+
+		/* Breakpoints are checked here rather than by TamaLIB, so that
+		 * their number does not matter. They apply whenever the CPU reaches
+		 * an instruction, including an interrupt vector.
+		 */
+		if (executed && wp_hit) {
+			wp_report(pc, &hal_log);
+			stop_execution();
+		} else if (moved && bp_get_num() && bp_check(*(state->pc))) {
+			stop_execution();
+		}
+
+		/* A step always ends with a stop reply, even if the CPU is halted */
+		if (gdb_enable && gdb_stub_is_stepping()) {
+			gdb_stub_notify_stop();
+		}
+
+		if (watch_enable) {
+			watch_check(pc, executed);
+		}
+
+		if (trace_enable && executed) {
+			trace_record(pc, g_program[pc]);
+		}
+
+		/* Update the screen @ FRAMERATE fps whatever the speed, frames
+		 * being skipped when running faster than real time. On the virtual
+		 * clock, this and the following periodic tasks happen at fixed
+		 * emulated times, so that they are reproducible as well.
+		 */
+		ts = hal_get_timestamp();
+		if (ts - screen_ts >= 1000000/FRAMERATE) {
+			screen_ts = ts;
+			hal_update_screen();
+
+			/* Same for the buzzer */
+			is_audio_playing = requested_audio_playing;
+		}
+
+		if (export_enable && ts - export_ts >= 1000000/export_rate) {
+			export_ts = ts;
+			shm_export_update(shown_pet->matrix, shown_pet->icons);
+		}
+
+		/* The debugger is polled continuously only while it holds the execution */
+		if (gdb_enable && (gdb_stub_is_stopped() || ts - gdb_ts >= 1000000/GDB_POLL_RATE)) {
+			gdb_ts = ts;
+			gdb_stub_poll();
+
+			/* The debugger might have written to the memory */
+			if (watch_enable) {
+				watch_request_scan();
+			}
+		}
+	}
+}
+
+/* Ages the given save in place, called by the fleet workers */
+static int run_fleet_pet(char *path, uint64_t *ticks)
+{
+	pet_t *pet = &pets[0];
+	char *tmp_path;
+	int ret = 0;
+
+	if (quit_requested) {
+		return -1;
+	}
+
+	pet_swap_in(&fleet_boot_pet);
+	if (state_load(path) < 0) {
+		return -1;
+	}
+
+	sync_total_ticks();
+	pet->ticks = 0;
+	pet->done = 0;
+
+	mainloop();
+
+	*ticks = get_pet_ticks(pet);
+
+	/* An interrupted pet is left as it was */
+	if (quit_requested) {
+		return -1;
+	}
+
+	/* Written aside, then renamed, so that a worker dying on the way (or
+	 * a full disk) never leaves a truncated save behind
+	 */
+	tmp_path = (char *) SDL_malloc(strlen(path) + 5);
+	if (tmp_path == NULL) {
+		return -1;
+	}
+
+	sprintf(tmp_path, "%s.tmp", path);
+
+	if (state_save(tmp_path) < 0 || rename(tmp_path, path) < 0) {
+		fprintf(stderr, "FATAL: Cannot update state file \"%s\" !\n", path);
+		remove(tmp_path);
+		ret = -1;
+	}
+
+	SDL_free(tmp_path);
+
+	return ret;
+}
+
 static void audio_callback(void *userdata, Uint8 *stream, int len)
 {
 	unsigned int i;
@@ -715,9 +1249,9 @@ static void set_rom_basename(char *path)
 	char *last_point, *start;
 	char tmp_str[256];
 
-	strncpy(tmp_str, path, 256);
+	snprintf(tmp_str, sizeof(tmp_str), "%s", path);
 	start = basename(tmp_str);
-	strncpy(rom_basename, start, 256);
+	snprintf(rom_basename, sizeof(rom_basename), "%s", start);
 
 	last_point = strrchr(rom_basename, '.');
 	if (last_point != NULL) {
@@ -735,19 +1269,50 @@ static void usage(FILE * fp, int argc, char **argv)
 		"Options:\n"
 		"\t-r | --rom <path>             The ROM file to use (default is %s)\n"
 		"\t-E | --extract <path>         PNG file to use when extracting the data/sprites from a ROM\n"
+		"\t-p | --palette                Extract the data/sprites to a palette-indexed PNG file\n"
+		"\t-z | --compression <0-9>      zlib compression level used for the extracted PNG file\n"
+		"\t     --png-filter <name>      PNG filters used for the extracted PNG file (none, sub, up, avg, paeth, all)\n"
 		"\t-M | --modify <path>          PNG file to use when modifying the data/sprites of a ROM\n"
 		"\t-H | --header                 Generate a header file from the ROM (written to STDOUT)\n"
-		"\t-l | --load <path>            Load the given memory state file (save)\n"
+		"\t     --packed                 Pack two 12-bit words in three bytes in the generated header\n"
+		"\t-I | --info                   Print information about the ROM (size, fingerprint, type)\n"
+		"\t-S | --shared-rom             Share a read-only copy of the ROM with the other instances\n"
+		"\t-l | --load <path>            Load the given memory state file (save), once per pet to run up to "STR(PET_MAX)" of them\n"
 		"\t-s | --step                   Enable step by step debugging from the start\n"
-		"\t-b | --break <0xXXX>          Add a breakpoint\n"
+		"\t-b | --break <0xXXX[,cond]>   Add a breakpoint, optionally conditional (A==5, M[0x04A]!=0, X>=0x100...)\n"
+		"\t-W | --watchpoint <0xXXX[-0xXXX][,r|w|rw]>\n"
+		"\t                              Break when the given memory address/range is read and/or written\n"
 		"\t-t | --type <name>            Force device type to name (default is auto detect)\n"
+		"\t-n | --headless               Run without any window nor audio (stop with Ctrl-C/SIGTERM)\n"
+		"\t-f | --speed <x>              Emulation speed, from "STR(SPEED_MIN)" to "STR(SPEED_MAX)" (0 means unlimited, default is 1)\n"
+		"\t     --timing <mode>          How to wait between instructions: sleep (low CPU load, default), spin (accurate,\n"
+		"\t                              100%% CPU) or hybrid (sleeps, then spins for the measured sleep overshoot)\n"
+		"\t-d | --deterministic          Derive the time from the emulated cycles (reproducible, as fast as possible)\n"
+		"\t-a | --age <hours>            Run headless at unlimited speed for the given emulated duration, then save\n"
+		"\t-o | --output <path>          Memory state file written when done aging, once per pet (default is a new save)\n"
+		"\t-F | --fleet <dir>            Age all the saves (*.bin) of the given directory in place, using worker processes\n"
+		"\t-j | --jobs <n>               Number of fleet workers (default is the number of CPU cores)\n"
 		"\t-m | --memory                 Show memory access\n"
+		"\t-w | --watch <0xXXX[-0xXXX]>  Record the changes of the given memory address/range\n"
+		"\t     --watch-log <path>       Write the recorded changes to the given file when exiting\n"
+		"\t-R | --record <path>          Record the button events to the given input script\n"
+		"\t-P | --play <path>            Play the button events of the given input script\n"
+		"\t-T | --trace <path>           Record every executed instruction to the given binary trace file\n"
+		"\t     --trace-size <n>         Number of instructions kept in the trace file, the oldest ones being\n"
+		"\t                              overwritten (default is "STR(TRACE_DEFAULT_RECORDS)")\n"
+		"\t-D | --disasm <path>          Disassemble the given trace file (written to STDOUT)\n"
 #if !defined(__WIN32__)
 		"\t-e | --editor                 Realtime memory editor\n"
+		"\t-x | --export <name>          Export the memory, registers and LCD to the given POSIX shared memory\n"
+		"\t     --export-rate <hz>       Shared memory update rate (default is "STR(DEFAULT_EXPORT_RATE)" Hz)\n"
+		"\t-g | --gdb <port|path>        Wait for GDB on the given local TCP port or Unix socket\n"
 #endif
 		"\t-c | --cpu                    Show CPU related information\n"
 		"\t-i | --int                    Show interrupt related information\n"
 		"\t-v | --verbose                Show all information\n"
+		"\t     --log-start <0xXXX[:n]>  Only show the information above once the given PC is reached (n times)\n"
+		"\t     --log-stop <0xXXX[:n]>   Stop showing the information above once the given PC is reached (n times)\n"
+		"\t     --log-ticks <t1[-t2]>    Only show the information above between the given ticks (32768 Hz)\n"
 		"\t-h | --help                   Print this message\n",
 		argv[0], ROM_PATH);
 
@@ -761,22 +1326,50 @@ static void usage(FILE * fp, int argc, char **argv)
 	fprintf(fp, "\n");
 }
 
-static const char short_options[] = "r:E:M:Hl:sb:t:mecivh";
+static const char short_options[] = "r:E:pz:M:HISl:sb:W:t:nf:da:o:F:j:mw:R:P:T:D:ex:g:civh";
 
 static const struct option long_options[] = {
 	{"rom", required_argument, NULL, 'r'},
 	{"extract", required_argument, NULL, 'E'},
+	{"palette", no_argument, NULL, 'p'},
+	{"compression", required_argument, NULL, 'z'},
+	{"png-filter", required_argument, NULL, OPT_PNG_FILTER},
 	{"modify", required_argument, NULL, 'M'},
 	{"header", no_argument, NULL, 'H'},
+	{"packed", no_argument, NULL, OPT_PACKED},
+	{"info", no_argument, NULL, 'I'},
+	{"shared-rom", no_argument, NULL, 'S'},
 	{"load", required_argument, NULL, 'l'},
 	{"step", no_argument, NULL, 's'},
 	{"break", required_argument, NULL, 'b'},
+	{"watchpoint", required_argument, NULL, 'W'},
 	{"type", required_argument, NULL, 't'},
+	{"headless", no_argument, NULL, 'n'},
+	{"speed", required_argument, NULL, 'f'},
+	{"timing", required_argument, NULL, OPT_TIMING},
+	{"deterministic", no_argument, NULL, 'd'},
+	{"age", required_argument, NULL, 'a'},
+	{"output", required_argument, NULL, 'o'},
+	{"fleet", required_argument, NULL, 'F'},
+	{"jobs", required_argument, NULL, 'j'},
 	{"memory", no_argument, NULL, 'm'},
+	{"watch", required_argument, NULL, 'w'},
+	{"watch-log", required_argument, NULL, OPT_WATCH_LOG},
+	{"record", required_argument, NULL, 'R'},
+	{"play", required_argument, NULL, 'P'},
+	{"trace", required_argument, NULL, 'T'},
+	{"trace-size", required_argument, NULL, OPT_TRACE_SIZE},
+	{"disasm", required_argument, NULL, 'D'},
 	{"editor", no_argument, NULL, 'e'},
+	{"export", required_argument, NULL, 'x'},
+	{"export-rate", required_argument, NULL, OPT_EXPORT_RATE},
+	{"gdb", required_argument, NULL, 'g'},
 	{"cpu", no_argument, NULL, 'c'},
 	{"int", no_argument, NULL, 'i'},
 	{"verbose", no_argument, NULL, 'v'},
+	{"log-start", required_argument, NULL, OPT_LOG_START},
+	{"log-stop", required_argument, NULL, OPT_LOG_STOP},
+	{"log-ticks", required_argument, NULL, OPT_LOG_TICKS},
 	{"help", no_argument, NULL, 'h'},
 	{0, 0, 0, 0}
 };
@@ -785,10 +1378,37 @@ int main(int argc, char **argv)
 {
 	char rom_path[256] = ROM_PATH;
 	char sprites_path[256] = {0};
-	char save_path[256] = {0};
+	char save_path[PET_MAX][256] = {{0}};
+	uint32_t save_num = 0;
+	char index_path[300];
+	char watch_path[256] = {0};
+	char export_name[256] = {0};
+	char trace_path[256] = {0};
+	unsigned long trace_records = TRACE_DEFAULT_RECORDS;
+	char record_path[256] = {0};
+	char play_path[256] = {0};
+	char gdb_addr[256] = {0};
+	char output_path[PET_MAX][256] = {{0}};
+	uint32_t output_num = 0;
+	char fleet_dir[256] = {0};
+	uint32_t fleet_jobs = 0;
+	fleet_stats_t fleet_stats;
+	double age_hours;
+	uint64_t age_start = 0;
+	double age_seconds;
 	bool_t gen_header = 0;
+	bool_t packed_header = 0;
+	bool_t print_info = 0;
 	bool_t extract_sprites = 0;
 	bool_t modify_sprites = 0;
+	bool_t indexed_sprites = 0;
+	int png_compression = IMAGE_DEFAULT;
+	int png_filters = IMAGE_DEFAULT;
+	bool_t share_rom = 0;
+	u12_t *shared_program;
+	uint32_t i;
+	char *end;
+	unsigned long val;
 
 #if defined(__WIN32__)
 	QueryPerformanceFrequency(&counter_freq);
@@ -810,25 +1430,64 @@ int main(int argc, char **argv)
 				break;
 
 			case 'r':
-				strncpy(rom_path, optarg, 256);
+				snprintf(rom_path, sizeof(rom_path), "%s", optarg);
 				break;
 
 			case 'E':
 				extract_sprites = 1;
-				strncpy(sprites_path, optarg, 256);
+				snprintf(sprites_path, sizeof(sprites_path), "%s", optarg);
+				break;
+
+			case 'p':
+				indexed_sprites = 1;
+				break;
+
+			case 'z':
+				val = strtoul(optarg, &end, 0);
+				if (end == optarg || *end != '\0' || val > 9) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				png_compression = val;
+				break;
+
+			case OPT_PNG_FILTER:
+				png_filters = image_filters_from_str(optarg);
+				if (png_filters == IMAGE_DEFAULT) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
 				break;
 
 			case 'M':
 				modify_sprites = 1;
-				strncpy(sprites_path, optarg, 256);
+				snprintf(sprites_path, sizeof(sprites_path), "%s", optarg);
 				break;
 
 			case 'H':
 				gen_header = 1;
 				break;
 
+			case OPT_PACKED:
+				packed_header = 1;
+				break;
+
+			case 'I':
+				print_info = 1;
+				break;
+
+			case 'S':
+				share_rom = 1;
+				break;
+
 			case 'l':
-				strncpy(save_path, optarg, 256);
+				if (save_num >= PET_MAX) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				snprintf(save_path[save_num++], sizeof(save_path[0]), "%s", optarg);
 				break;
 
 			case 's':
@@ -836,21 +1495,154 @@ int main(int argc, char **argv)
 				break;
 
 			case 'b':
-				tamalib_add_bp(&g_breakpoints, strtoul(optarg, NULL, 0));
+				if (bp_add_str(optarg) < 0) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'W':
+				if (wp_add_str(optarg) < 0) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
 				break;
 
 			case 't':
 				rom_type = program_validate_type_str(optarg);
 				break;
 
+			case 'n':
+				headless = 1;
+				break;
+
+			case OPT_TIMING:
+				if (!strcmp(optarg, "sleep")) {
+					timing_mode = TIMING_SLEEP;
+				} else if (!strcmp(optarg, "spin")) {
+					timing_mode = TIMING_SPIN;
+				} else if (!strcmp(optarg, "hybrid")) {
+					timing_mode = TIMING_HYBRID;
+				} else {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'd':
+				virtual_clock = 1;
+				break;
+
+			case 'a':
+				age_hours = strtod(optarg, &end);
+				if (end == optarg || *end != '\0' || !(age_hours > 0 && age_hours <= AGE_HOURS_MAX)) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				age_enable = 1;
+				age_ticks = (uint64_t) (age_hours * 3600 * TICK_RATE);
+				break;
+
+			case 'o':
+				if (output_num >= PET_MAX) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				snprintf(output_path[output_num++], sizeof(output_path[0]), "%s", optarg);
+				break;
+
+			case 'F':
+				snprintf(fleet_dir, sizeof(fleet_dir), "%s", optarg);
+				break;
+
+			case 'j':
+				val = strtoul(optarg, &end, 0);
+				if (end == optarg || *end != '\0' || val == 0 || val > FLEET_WORKER_MAX) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				fleet_jobs = val;
+				break;
+
+			case 'f':
+				speed = strtod(optarg, &end);
+				if (end == optarg || *end != '\0' || (speed != SPEED_UNLIMITED && !(speed >= SPEED_MIN && speed <= SPEED_MAX))) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
 			case 'm':
 				log_levels |= LOG_MEMORY;
 				break;
 
+			case 'w':
+				if (watch_add_str(optarg) < 0) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				watch_enable = 1;
+				break;
+
+			case OPT_WATCH_LOG:
+				snprintf(watch_path, sizeof(watch_path), "%s", optarg);
+				break;
+
+			case 'R':
+				record_enable = 1;
+				snprintf(record_path, sizeof(record_path), "%s", optarg);
+				break;
+
+			case 'P':
+				play_enable = 1;
+				snprintf(play_path, sizeof(play_path), "%s", optarg);
+				break;
+
+			case 'T':
+				trace_enable = 1;
+				snprintf(trace_path, sizeof(trace_path), "%s", optarg);
+				break;
+
+			case OPT_TRACE_SIZE:
+				trace_records = strtoul(optarg, &end, 0);
+				if (end == optarg || *end != '\0' || trace_records == 0 || trace_records > TRACE_RECORDS_MAX) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'D':
+				/* Offline, no ROM needed */
+				exit(trace_dump(optarg) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
 #if !defined(__WIN32__)
 			case 'e':
 				memory_editor_enable = 1;
 				break;
+
+			case 'x':
+				export_enable = 1;
+				snprintf(export_name, sizeof(export_name), "%s", optarg);
+				break;
+
+			case OPT_EXPORT_RATE:
+				val = strtoul(optarg, &end, 0);
+				if (end == optarg || *end != '\0' || val == 0 || val > EXPORT_RATE_MAX) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				export_rate = val;
+				break;
+
+			case 'g':
+				gdb_enable = 1;
+				snprintf(gdb_addr, sizeof(gdb_addr), "%s", optarg);
+				break;
 #endif
 
 			case 'c':
@@ -865,6 +1657,25 @@ int main(int argc, char **argv)
 				log_levels |= LOG_MEMORY | LOG_CPU;
 				break;
 
+			case OPT_LOG_START:
+			case OPT_LOG_STOP:
+				if (log_window_add_trigger_str((c == OPT_LOG_START) ? LOG_TRIGGER_START : LOG_TRIGGER_STOP, optarg) < 0) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				log_window_enable = 1;
+				break;
+
+			case OPT_LOG_TICKS:
+				if (log_window_set_ticks_str(optarg) < 0) {
+					usage(stderr, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				log_window_enable = 1;
+				break;
+
 			case 'h':
 				usage(stdout, argc, argv);
 				exit(EXIT_SUCCESS);
@@ -875,76 +1686,279 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* One pet per loaded save */
+	if (save_num > 1) {
+		pet_num = save_num;
+	}
+
+	/* The fleet ages saves in place */
+	if (fleet_dir[0] && (!age_enable || save_num || output_num)) {
+		usage(stderr, argc, argv);
+		exit(EXIT_FAILURE);
+	}
+
+	/* These features follow the CPU state, which only belongs to the
+	 * running pet (the exported RAM and registers included)
+	 */
+	if ((pet_num > 1 || fleet_dir[0]) && (memory_editor_enable || watch_enable || trace_enable || record_enable || play_enable ||
+		gdb_enable || export_enable || log_window_enable || bp_get_num() || wp_get_num())) {
+		fprintf(stderr, "FATAL: Debugging and export features are not available with several pets !\n");
+		return -1;
+	}
+
+	/* The log thread would not survive the fork() of the fleet workers */
+	if (fleet_dir[0] && (log_levels & (LOG_MEMORY | LOG_CPU | LOG_INT))) {
+		fprintf(stderr, "FATAL: Verbose logs are not available in fleet mode !\n");
+		return -1;
+	}
+
 	set_rom_basename(rom_path);
 
 	g_program = program_load(rom_path, &g_program_size);
 	if (g_program == NULL) {
 		hal_log(LOG_ERROR, "FATAL: Error while loading ROM %s !\n", rom_path);
-		tamalib_free_bp(&g_breakpoints);
 		rom_not_found_msg();
 		return -1;
 	}
 
+	if (print_info) {
+		program_print_info(g_program, g_program_size);
+		SDL_free(g_program);
+		return 0;
+	}
+
 	if (rom_type == NULL) {
-		rom_type = program_detect_type_str(g_program);
+		rom_type = program_detect_type_str(g_program, g_program_size);
 	}
 
 	if (gen_header || extract_sprites || modify_sprites) {
 		/* ROM manipulation only (no emulation) */
 		if (gen_header) {
-			program_to_header(g_program, g_program_size);
+			program_to_header(g_program, g_program_size, packed_header);
 		} else if (extract_sprites) {
-			program_get_data(g_program, g_program_size, sprites_path);
+			snprintf(index_path, sizeof(index_path), SPRITE_INDEX_TEMPLATE, sprites_path);
+			program_get_data(g_program, g_program_size, sprites_path, index_path, indexed_sprites, png_compression, png_filters);
 		} else if (modify_sprites) {
-			program_set_data(g_program, g_program_size, sprites_path);
+			snprintf(index_path, sizeof(index_path), SPRITE_INDEX_TEMPLATE, sprites_path);
+			program_set_data(g_program, g_program_size, sprites_path, index_path);
 			program_save(rom_path, g_program, g_program_size);
 		}
 
 		SDL_free(g_program);
-		tamalib_free_bp(&g_breakpoints);
 		return 0;
 	}
 
-	compute_layout();
+	if (share_rom) {
+		/* The emulation never modifies the program */
+		shared_program = program_share(g_program, g_program_size);
+		if (shared_program != NULL) {
+			SDL_free(g_program);
+			g_program = shared_program;
+			g_program_shared = 1;
+		}
+	}
 
-	if (sdl_init()) {
-		hal_log(LOG_ERROR, "FATAL: Error while initializing application !\n");
-		SDL_free(g_program);
-		tamalib_free_bp(&g_breakpoints);
-		return -1;
+	if (age_enable) {
+		/* Nothing to render, and no reason to wait */
+		headless = 1;
+		speed = SPEED_UNLIMITED;
+		virtual_clock = 1;
 	}
 
-	if (tamalib_init(g_program, g_breakpoints, 1000000)) {
+#if defined(__linux__)
+	if (timing_mode == TIMING_HYBRID) {
+		/* The default 50 us timer slack would be part of every overshoot */
+		prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+	}
+#endif
+
+	if (headless) {
+		signal(SIGINT, &quit_signal_handler);
+		signal(SIGTERM, &quit_signal_handler);
+	} else {
+		compute_layout();
+
+		if (sdl_init()) {
+			hal_log(LOG_ERROR, "FATAL: Error while initializing application !\n");
+			free_program();
+			return -1;
+		}
+	}
+
+	if (tamalib_init(g_program, NULL, 1000000)) {
 		hal_log(LOG_ERROR, "FATAL: Error while initializing tamalib !\n");
-		sdl_release();
-		SDL_free(g_program);
-		tamalib_free_bp(&g_breakpoints);
+		if (!headless) {
+			sdl_release();
+		}
+		free_program();
 		return -1;
 	}
 
-	if (save_path[0]) {
-		state_load(save_path);
+	/* The pace is kept by the main loop */
+	tamalib_set_speed(0);
+
+	/* Every pet boots from the initial state, then loads its save */
+	for (i = 0; i < pet_num; i++) {
+		if (pet_init(&pets[i]) < 0) {
+			hal_log(LOG_ERROR, "FATAL: Error while initializing the pets !\n");
+			while (i--) {
+				pet_release(&pets[i]);
+			}
+			tamalib_release();
+			if (!headless) {
+				sdl_release();
+			}
+			free_program();
+			return -1;
+		}
+	}
+
+	sync_total_ticks();
+
+	for (i = 0; i < pet_num; i++) {
+		if (save_path[i][0]) {
+			switch_pet(&pets[i]);
+			state_load(save_path[i]);
+			sync_total_ticks();
+		}
+	}
+
+	switch_pet(&pets[0]);
+	sync_total_ticks();
+	virtual_clock_started = 1;
+
+	if (watch_enable) {
+		watch_start();
+	}
+
+	if (export_enable && shm_export_open(export_name) < 0) {
+		export_enable = 0;
+	}
+
+	if (trace_enable && trace_open(trace_path, trace_records) < 0) {
+		trace_enable = 0;
+	}
+
+	if (record_enable && input_script_record_open(record_path) < 0) {
+		record_enable = 0;
+	}
+
+	if (play_enable && input_script_play_open(play_path) < 0) {
+		play_enable = 0;
+	}
+
+	if (gdb_enable) {
+		if (gdb_stub_open(gdb_addr, g_program, g_program_size) < 0) {
+			gdb_enable = 0;
+		} else {
+			/* Nothing runs until the debugger is attached */
+			hal_log(LOG_INFO, "Waiting for GDB on %s\n", gdb_addr);
+			tamalib_set_exec_mode(EXEC_MODE_PAUSE);
+		}
 	}
 
 	if (memory_editor_enable) {
 		/* Logs are not compatible with the memory editor */
 		log_levels = LOG_ERROR;
 		mem_edit_configure_terminal();
+		log_window_enable = 0;
+	}
+
+	if (log_window_enable) {
+		/* The selected verbose levels are only enabled inside the windows */
+		log_window_levels = log_levels & (LOG_MEMORY | LOG_CPU | LOG_INT);
+		if (!log_window_levels) {
+			log_window_levels = LOG_CPU;
+		}
+		log_levels &= ~log_window_levels;
+	}
+
+	if (((log_levels | log_window_levels) & (LOG_MEMORY | LOG_CPU | LOG_INT)) && !async_log_start()) {
+		async_log_enable = 1;
 	}
 
-	tamalib_mainloop();
+	if (age_enable) {
+		age_start = SDL_GetPerformanceCounter();
+	}
+
+	if (fleet_dir[0]) {
+		if (!fleet_jobs) {
+			fleet_jobs = SDL_GetCPUCount();
+		}
+
+		/* The workers start every pet from the current (boot) state */
+		if (pet_init(&fleet_boot_pet) == 0) {
+			if (fleet_run(fleet_dir, fleet_jobs, &run_fleet_pet, &fleet_stats) == 0) {
+				age_seconds = (double) (SDL_GetPerformanceCounter() - age_start) / SDL_GetPerformanceFrequency();
+				hal_log(LOG_INFO, "Aged %u pets (%u failed) in %.2f s with %u workers, %.0f emulated s per second\n",
+					fleet_stats.pets, fleet_stats.failed, age_seconds, fleet_jobs,
+					(double) fleet_stats.ticks / TICK_RATE / (age_seconds > 0 ? age_seconds : 1));
+			}
+
+			pet_release(&fleet_boot_pet);
+		}
+	} else {
+		mainloop();
+	}
+
+	if (age_enable && !fleet_dir[0]) {
+		age_seconds = (double) (SDL_GetPerformanceCounter() - age_start) / SDL_GetPerformanceFrequency();
+
+		for (i = 0; i < pet_num; i++) {
+			switch_pet(&pets[i]);
+
+			if (!output_path[i][0]) {
+				state_find_next_name(output_path[i], rom_basename);
+			}
+			state_save(output_path[i]);
+
+			/* Might be shorter than requested if interrupted */
+			age_hours = (double) pets[i].ticks / TICK_RATE / 3600;
+			hal_log(LOG_INFO, "Aged %.2f h in %.2f s (x%.0f), state saved to %s\n", age_hours, age_seconds,
+				age_hours * 3600 / (age_seconds > 0 ? age_seconds : 1), output_path[i]);
+		}
+	}
+
+	if (async_log_enable) {
+		async_log_enable = 0;
+		async_log_stop();
+	}
 
 	if (memory_editor_enable) {
 		mem_edit_reset_terminal();
 	}
 
-	tamalib_release();
+	if (watch_enable && watch_path[0]) {
+		watch_dump(watch_path);
+	}
+
+	if (export_enable) {
+		shm_export_close();
+	}
 
-	sdl_release();
+	if (trace_enable) {
+		trace_close();
+	}
+
+	if (record_enable || play_enable) {
+		input_script_close();
+	}
 
-	SDL_free(g_program);
+	if (gdb_enable) {
+		gdb_stub_close();
+	}
+
+	for (i = 0; i < pet_num; i++) {
+		pet_release(&pets[i]);
+	}
+
+	tamalib_release();
+
+	if (!headless) {
+		sdl_release();
+	}
 
-	tamalib_free_bp(&g_breakpoints);
+	free_program();
 
 	return 0;
 }
@@ -0,0 +1,509 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#if !defined(__WIN32__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "trace.h"
+
+#define TRACE_FILE_MAGIC				"TLTR"
+#define TRACE_FILE_VERSION				1
+#define TRACE_HEADER_SIZE				16
+
+/* Records are written as 16 bytes little-endian */
+#define TRACE_RECORD_SIZE				16
+
+/* The header holds the number of record slots and the index of the next
+ * one to be written, so that the oldest records can be overwritten while
+ * the file keeps a fixed size
+ */
+#define TRACE_HEADER_WRAPPED				6
+#define TRACE_HEADER_CAPACITY				8
+#define TRACE_HEADER_INDEX				12
+
+#define MASK_4B						0xF00
+#define MASK_6B						0xFC0
+#define MASK_7B						0xFE0
+#define MASK_8B						0xFF0
+#define MASK_10B					0xFFC
+#define MASK_12B					0xFFF
+
+typedef enum {
+	ARG_NONE,
+	ARG_S,		// 8-bit immediate/address
+	ARG_I,		// 4-bit immediate/address
+	ARG_P,		// 5-bit page
+	ARG_R,		// r in bits 0-1
+	ARG_RR,		// r in bits 0-1 (repeated in bits 2-3)
+	ARG_R_HI,	// r in bits 4-5 (NOT)
+	ARG_R_I,	// r in bits 4-5, 4-bit immediate
+	ARG_R_Q,	// r in bits 2-3, q in bits 0-1
+} arg_t;
+
+typedef struct {
+	u12_t code;
+	u12_t mask;
+	char *fmt;
+	arg_t arg;
+} op_t;
+
+/* More specific masks first */
+static const op_t ops[] = {
+	{0xFE8, MASK_12B, "JPBA", ARG_NONE},
+	{0xFDF, MASK_12B, "RET", ARG_NONE},
+	{0xFDE, MASK_12B, "RETS", ARG_NONE},
+	{0xFFB, MASK_12B, "NOP5", ARG_NONE},
+	{0xFFF, MASK_12B, "NOP7", ARG_NONE},
+	{0xFF8, MASK_12B, "HALT", ARG_NONE},
+	{0xFF9, MASK_12B, "SLP", ARG_NONE},
+	{0xEE0, MASK_12B, "INC  X", ARG_NONE},
+	{0xEF0, MASK_12B, "INC  Y", ARG_NONE},
+	{0xF41, MASK_12B, "SCF", ARG_NONE},
+	{0xF5E, MASK_12B, "RCF", ARG_NONE},
+	{0xF42, MASK_12B, "SZF", ARG_NONE},
+	{0xF5D, MASK_12B, "RZF", ARG_NONE},
+	{0xF44, MASK_12B, "SDF", ARG_NONE},
+	{0xF5B, MASK_12B, "RDF", ARG_NONE},
+	{0xF48, MASK_12B, "EI", ARG_NONE},
+	{0xF57, MASK_12B, "DI", ARG_NONE},
+	{0xFDB, MASK_12B, "INC  SP", ARG_NONE},
+	{0xFCB, MASK_12B, "DEC  SP", ARG_NONE},
+	{0xFC4, MASK_12B, "PUSH XP", ARG_NONE},
+	{0xFC5, MASK_12B, "PUSH XH", ARG_NONE},
+	{0xFC6, MASK_12B, "PUSH XL", ARG_NONE},
+	{0xFC7, MASK_12B, "PUSH YP", ARG_NONE},
+	{0xFC8, MASK_12B, "PUSH YH", ARG_NONE},
+	{0xFC9, MASK_12B, "PUSH YL", ARG_NONE},
+	{0xFCA, MASK_12B, "PUSH F", ARG_NONE},
+	{0xFD4, MASK_12B, "POP  XP", ARG_NONE},
+	{0xFD5, MASK_12B, "POP  XH", ARG_NONE},
+	{0xFD6, MASK_12B, "POP  XL", ARG_NONE},
+	{0xFD7, MASK_12B, "POP  YP", ARG_NONE},
+	{0xFD8, MASK_12B, "POP  YH", ARG_NONE},
+	{0xFD9, MASK_12B, "POP  YL", ARG_NONE},
+	{0xFDA, MASK_12B, "POP  F", ARG_NONE},
+	{0xD0F, 0xFCF, "NOT  %s", ARG_R_HI},
+
+	{0xE80, MASK_10B, "LD   XP, %s", ARG_R},
+	{0xE84, MASK_10B, "LD   XH, %s", ARG_R},
+	{0xE88, MASK_10B, "LD   XL, %s", ARG_R},
+	{0xE8C, MASK_10B, "RRC  %s", ARG_R},
+	{0xE90, MASK_10B, "LD   YP, %s", ARG_R},
+	{0xE94, MASK_10B, "LD   YH, %s", ARG_R},
+	{0xE98, MASK_10B, "LD   YL, %s", ARG_R},
+	{0xEA0, MASK_10B, "LD   %s, XP", ARG_R},
+	{0xEA4, MASK_10B, "LD   %s, XH", ARG_R},
+	{0xEA8, MASK_10B, "LD   %s, XL", ARG_R},
+	{0xEB0, MASK_10B, "LD   %s, YP", ARG_R},
+	{0xEB4, MASK_10B, "LD   %s, YH", ARG_R},
+	{0xEB8, MASK_10B, "LD   %s, YL", ARG_R},
+	{0xFC0, MASK_10B, "PUSH %s", ARG_R},
+	{0xFD0, MASK_10B, "POP  %s", ARG_R},
+	{0xFE0, MASK_10B, "LD   SPH, %s", ARG_R},
+	{0xFE4, MASK_10B, "LD   %s, SPH", ARG_R},
+	{0xFF0, MASK_10B, "LD   SPL, %s", ARG_R},
+	{0xFF4, MASK_10B, "LD   %s, SPL", ARG_R},
+	{0xF28, MASK_10B, "ACPX MX, %s", ARG_R},
+	{0xF2C, MASK_10B, "ACPY MY, %s", ARG_R},
+	{0xF38, MASK_10B, "SCPX MX, %s", ARG_R},
+	{0xF3C, MASK_10B, "SCPY MY, %s", ARG_R},
+
+	{0xA00, MASK_8B, "ADC  XH, 0x%X", ARG_I},
+	{0xA10, MASK_8B, "ADC  XL, 0x%X", ARG_I},
+	{0xA20, MASK_8B, "ADC  YH, 0x%X", ARG_I},
+	{0xA30, MASK_8B, "ADC  YL, 0x%X", ARG_I},
+	{0xA40, MASK_8B, "CP   XH, 0x%X", ARG_I},
+	{0xA50, MASK_8B, "CP   XL, 0x%X", ARG_I},
+	{0xA60, MASK_8B, "CP   YH, 0x%X", ARG_I},
+	{0xA70, MASK_8B, "CP   YL, 0x%X", ARG_I},
+	{0xE60, MASK_8B, "LDPX MX, 0x%X", ARG_I},
+	{0xE70, MASK_8B, "LDPY MY, 0x%X", ARG_I},
+	{0xF40, MASK_8B, "SET  F, 0x%X", ARG_I},
+	{0xF50, MASK_8B, "RST  F, 0x%X", ARG_I},
+	{0xF60, MASK_8B, "INC  M(0x%X)", ARG_I},
+	{0xF70, MASK_8B, "DEC  M(0x%X)", ARG_I},
+	{0xF80, MASK_8B, "LD   M(0x%X), A", ARG_I},
+	{0xF90, MASK_8B, "LD   M(0x%X), B", ARG_I},
+	{0xFA0, MASK_8B, "LD   A, M(0x%X)", ARG_I},
+	{0xFB0, MASK_8B, "LD   B, M(0x%X)", ARG_I},
+	{0xAF0, MASK_8B, "RLC  %s", ARG_RR},
+	{0xA80, MASK_8B, "ADD  %s, %s", ARG_R_Q},
+	{0xA90, MASK_8B, "ADC  %s, %s", ARG_R_Q},
+	{0xAA0, MASK_8B, "SUB  %s, %s", ARG_R_Q},
+	{0xAB0, MASK_8B, "SBC  %s, %s", ARG_R_Q},
+	{0xAC0, MASK_8B, "AND  %s, %s", ARG_R_Q},
+	{0xAD0, MASK_8B, "OR   %s, %s", ARG_R_Q},
+	{0xAE0, MASK_8B, "XOR  %s, %s", ARG_R_Q},
+	{0xEC0, MASK_8B, "LD   %s, %s", ARG_R_Q},
+	{0xEE0, MASK_8B, "LDPX %s, %s", ARG_R_Q},
+	{0xEF0, MASK_8B, "LDPY %s, %s", ARG_R_Q},
+	{0xF00, MASK_8B, "CP   %s, %s", ARG_R_Q},
+	{0xF10, MASK_8B, "FAN  %s, %s", ARG_R_Q},
+
+	{0xE40, MASK_7B, "PSET 0x%02X", ARG_P},
+
+	{0xC00, MASK_6B, "ADD  %s, 0x%X", ARG_R_I},
+	{0xC40, MASK_6B, "ADC  %s, 0x%X", ARG_R_I},
+	{0xC80, MASK_6B, "AND  %s, 0x%X", ARG_R_I},
+	{0xCC0, MASK_6B, "OR   %s, 0x%X", ARG_R_I},
+	{0xD00, MASK_6B, "XOR  %s, 0x%X", ARG_R_I},
+	{0xD40, MASK_6B, "SBC  %s, 0x%X", ARG_R_I},
+	{0xD80, MASK_6B, "FAN  %s, 0x%X", ARG_R_I},
+	{0xDC0, MASK_6B, "CP   %s, 0x%X", ARG_R_I},
+	{0xE00, MASK_6B, "LD   %s, 0x%X", ARG_R_I},
+
+	{0x000, MASK_4B, "JP   0x%02X", ARG_S},
+	{0x100, MASK_4B, "RETD 0x%02X", ARG_S},
+	{0x200, MASK_4B, "JP   C, 0x%02X", ARG_S},
+	{0x300, MASK_4B, "JP   NC, 0x%02X", ARG_S},
+	{0x400, MASK_4B, "CALL 0x%02X", ARG_S},
+	{0x500, MASK_4B, "CALZ 0x%02X", ARG_S},
+	{0x600, MASK_4B, "JP   Z, 0x%02X", ARG_S},
+	{0x700, MASK_4B, "JP   NZ, 0x%02X", ARG_S},
+	{0x800, MASK_4B, "LD   Y, 0x%02X", ARG_S},
+	{0x900, MASK_4B, "LBPX MX, 0x%02X", ARG_S},
+	{0xB00, MASK_4B, "LD   X, 0x%02X", ARG_S},
+};
+
+static char *reg_names[] = {"A", "B", "MX", "MY"};
+
+/* Header and records, mapped from the trace file so that they survive a
+ * crash (or only written when closing where mmap() is not available)
+ */
+static uint8_t *g_map = NULL;
+static uint8_t *g_records = NULL;
+static uint32_t g_capacity = 0;
+static uint32_t g_index = 0;
+static uint32_t g_map_size = 0;
+#if !defined(__WIN32__)
+static int g_fd = -1;
+#else
+static char g_path[256];
+#endif
+
+
+static void write_u16(uint8_t *buf, uint16_t val)
+{
+	buf[0] = val & 0xFF;
+	buf[1] = (val >> 8) & 0xFF;
+}
+
+static uint16_t read_u16(uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+static void write_u32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val & 0xFF;
+	buf[1] = (val >> 8) & 0xFF;
+	buf[2] = (val >> 16) & 0xFF;
+	buf[3] = (val >> 24) & 0xFF;
+}
+
+static uint32_t read_u32(uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+#if !defined(__WIN32__)
+static uint8_t * map_file(char *path, uint32_t size)
+{
+	uint8_t *map;
+
+	g_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (g_fd < 0) {
+		return NULL;
+	}
+
+	/* The file is sparse until the records are written */
+	if (ftruncate(g_fd, size) < 0) {
+		close(g_fd);
+		g_fd = -1;
+		return NULL;
+	}
+
+	map = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, g_fd, 0);
+	if (map == MAP_FAILED) {
+		close(g_fd);
+		g_fd = -1;
+		return NULL;
+	}
+
+	return map;
+}
+#else
+static void save_file(uint32_t size)
+{
+	FILE *fp;
+
+	fp = fopen(g_path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "FATAL: Cannot create trace file \"%s\" !\n", g_path);
+		return;
+	}
+
+	if (fwrite(g_map, size, 1, fp) != 1) {
+		fprintf(stderr, "FATAL: Failed to write to the trace file !\n");
+	}
+
+	fclose(fp);
+}
+#endif
+
+int trace_open(char *path, uint32_t records)
+{
+	if (records == 0 || records > TRACE_RECORDS_MAX) {
+		return -1;
+	}
+
+	g_map_size = TRACE_HEADER_SIZE + records * TRACE_RECORD_SIZE;
+
+#if !defined(__WIN32__)
+	g_map = map_file(path, g_map_size);
+#else
+	snprintf(g_path, sizeof(g_path), "%s", path);
+	g_map = (uint8_t *) SDL_malloc(g_map_size);
+#endif
+	if (g_map == NULL) {
+		fprintf(stderr, "FATAL: Cannot create trace file \"%s\" !\n", path);
+		return -1;
+	}
+
+	memset(g_map, 0, TRACE_HEADER_SIZE);
+	memcpy(g_map, TRACE_FILE_MAGIC, 4);
+	g_map[4] = TRACE_FILE_VERSION;
+	g_map[5] = TRACE_RECORD_SIZE;
+	write_u32(&g_map[TRACE_HEADER_CAPACITY], records);
+
+	g_records = &g_map[TRACE_HEADER_SIZE];
+	g_capacity = records;
+	g_index = 0;
+
+	return 0;
+}
+
+void trace_record(u13_t pc, u12_t op)
+{
+	state_t *state = tamalib_get_state();
+	uint8_t *r = &g_records[g_index * TRACE_RECORD_SIZE];
+	u32_t tick = *(state->tick_counter);
+
+	write_u32(&r[0], tick);
+	write_u16(&r[4], pc);
+	write_u16(&r[6], op);
+	write_u16(&r[8], *(state->x));
+	write_u16(&r[10], *(state->y));
+	r[12] = (*(state->a) & 0xF) | ((*(state->b) & 0xF) << 4);
+	r[13] = *(state->np);
+	r[14] = *(state->sp);
+	r[15] = *(state->flags);
+
+	if (++g_index == g_capacity) {
+		g_index = 0;
+		g_map[TRACE_HEADER_WRAPPED] = 1;
+	}
+
+	/* Published after the record, so that a crash never exposes a
+	 * partially written one
+	 */
+	write_u32(&g_map[TRACE_HEADER_INDEX], g_index);
+}
+
+void trace_close(void)
+{
+	uint32_t size;
+
+	if (g_map == NULL) {
+		return;
+	}
+
+	/* Do not keep the unused slots if the trace never wrapped around */
+	size = g_map[TRACE_HEADER_WRAPPED] ? g_map_size : TRACE_HEADER_SIZE + g_index * TRACE_RECORD_SIZE;
+
+#if !defined(__WIN32__)
+	munmap(g_map, g_map_size);
+	if (ftruncate(g_fd, size) < 0) {
+		fprintf(stderr, "FATAL: Failed to write to the trace file !\n");
+	}
+	close(g_fd);
+	g_fd = -1;
+#else
+	save_file(size);
+	SDL_free(g_map);
+#endif
+
+	g_map = NULL;
+	g_records = NULL;
+}
+
+void trace_disassemble(u12_t op, char *buf, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+		if ((op & ops[i].mask) != ops[i].code) {
+			continue;
+		}
+
+		switch (ops[i].arg) {
+			case ARG_NONE:
+				snprintf(buf, len, "%s", ops[i].fmt);
+				break;
+
+			case ARG_S:
+				snprintf(buf, len, ops[i].fmt, op & 0xFF);
+				break;
+
+			case ARG_I:
+				snprintf(buf, len, ops[i].fmt, op & 0xF);
+				break;
+
+			case ARG_P:
+				snprintf(buf, len, ops[i].fmt, op & 0x1F);
+				break;
+
+			case ARG_R:
+			case ARG_RR:
+				snprintf(buf, len, ops[i].fmt, reg_names[op & 0x3]);
+				break;
+
+			case ARG_R_HI:
+				snprintf(buf, len, ops[i].fmt, reg_names[(op >> 4) & 0x3]);
+				break;
+
+			case ARG_R_I:
+				snprintf(buf, len, ops[i].fmt, reg_names[(op >> 4) & 0x3], op & 0xF);
+				break;
+
+			case ARG_R_Q:
+				snprintf(buf, len, ops[i].fmt, reg_names[(op >> 2) & 0x3], reg_names[op & 0x3]);
+				break;
+		}
+
+		return;
+	}
+
+	snprintf(buf, len, "???");
+}
+
+static void parse_record(uint8_t *r, trace_record_t *rec)
+{
+	rec->tick = read_u32(&r[0]);
+	rec->pc = read_u16(&r[4]);
+	rec->op = read_u16(&r[6]);
+	rec->x = read_u16(&r[8]);
+	rec->y = read_u16(&r[10]);
+	rec->a = r[12] & 0xF;
+	rec->b = r[12] >> 4;
+	rec->np = r[13];
+	rec->sp = r[14];
+	rec->flags = r[15];
+}
+
+static void dump_record(uint8_t *r, trace_record_t *prev, bool_t first)
+{
+	trace_record_t rec;
+	char asm_str[32];
+
+	parse_record(r, &rec);
+	trace_disassemble(rec.op, asm_str, sizeof(asm_str));
+
+	fprintf(stdout, "%10u  0x%04X: 0x%03X  %-18s", rec.tick, rec.pc, rec.op, asm_str);
+
+	/* Only show the registers that changed */
+	if (first || rec.a != prev->a) fprintf(stdout, " A=%X", rec.a);
+	if (first || rec.b != prev->b) fprintf(stdout, " B=%X", rec.b);
+	if (first || rec.x != prev->x) fprintf(stdout, " X=%03X", rec.x);
+	if (first || rec.y != prev->y) fprintf(stdout, " Y=%03X", rec.y);
+	if (first || rec.np != prev->np) fprintf(stdout, " NP=%02X", rec.np);
+	if (first || rec.sp != prev->sp) fprintf(stdout, " SP=%02X", rec.sp);
+	if (first || rec.flags != prev->flags) fprintf(stdout, " F=%X", rec.flags);
+	fprintf(stdout, "\n");
+
+	*prev = rec;
+}
+
+int trace_dump(char *path)
+{
+	FILE *fp;
+	uint8_t header[TRACE_HEADER_SIZE];
+	uint8_t r[TRACE_RECORD_SIZE];
+	trace_record_t prev;
+	uint32_t capacity, index, start, num, i;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "FATAL: Cannot open trace file \"%s\" !\n", path);
+		return -1;
+	}
+
+	if (fread(header, TRACE_HEADER_SIZE, 1, fp) != 1 || memcmp(header, TRACE_FILE_MAGIC, 4) ||
+		header[4] != TRACE_FILE_VERSION || header[5] != TRACE_RECORD_SIZE) {
+		fprintf(stderr, "FATAL: \"%s\" is not a supported trace file !\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	capacity = read_u32(&header[TRACE_HEADER_CAPACITY]);
+	index = read_u32(&header[TRACE_HEADER_INDEX]);
+	if (index >= capacity) {
+		fprintf(stderr, "FATAL: \"%s\" is not a supported trace file !\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	/* Once wrapped around, the oldest record is the next one to be written */
+	if (header[TRACE_HEADER_WRAPPED]) {
+		start = index;
+		num = capacity;
+	} else {
+		start = 0;
+		num = index;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (i == 0 || start + i == capacity) {
+			if (fseek(fp, TRACE_HEADER_SIZE + (long) ((start + i) % capacity) * TRACE_RECORD_SIZE, SEEK_SET) < 0) {
+				break;
+			}
+		}
+
+		if (fread(r, TRACE_RECORD_SIZE, 1, fp) != 1) {
+			break;
+		}
+
+		dump_record(r, &prev, i == 0);
+	}
+
+	fclose(fp);
+
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "lib/tamalib.h"
+
+#define TRACE_DEFAULT_RECORDS		1048576 // 16 MiB
+#define TRACE_RECORDS_MAX		67108864 // 1 GiB
+
+typedef struct {
+	u32_t tick;
+	u13_t pc; // Address of the executed instruction
+	u12_t op;
+
+	/* Registers after the execution */
+	u12_t x;
+	u12_t y;
+	u4_t a;
+	u4_t b;
+	u5_t np;
+	u8_t sp;
+	u4_t flags;
+} trace_record_t;
+
+
+int trace_open(char *path, uint32_t records);
+void trace_record(u13_t pc, u12_t op);
+void trace_close(void);
+void trace_disassemble(u12_t op, char *buf, uint32_t len);
+int trace_dump(char *path);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,280 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "lib/tamalib.h"
+
+#include "breakpoint.h"
+#include "watch.h"
+
+/* Watched addresses, as a flag table (to ignore duplicates) and as a
+ * compact list (to be walked when a full scan is needed). The writes of
+ * the instructions are decoded along with the watchpoints, so that only
+ * the written addresses are compared.
+ */
+static bool_t g_watched[MEMORY_SIZE] = {0};
+static u12_t g_addresses[MEMORY_SIZE];
+static uint32_t g_num = 0;
+
+/* The hardware updates the I/O registers without any instruction, so
+ * these are compared after every step
+ */
+static u12_t g_io_addresses[MEM_IO_SIZE];
+static uint32_t g_num_io = 0;
+
+/* Last known value of each watched address */
+static u4_t g_shadow[MEMORY_SIZE];
+
+/* Set when the memory was modified outside of the emulation */
+static bool_t g_scan_requested = 0;
+
+/* Single producer ring buffer, the oldest entries being overwritten.
+ * The head is only incremented once an entry is complete, so that readers
+ * never need a lock.
+ */
+static watch_entry_t g_history[WATCH_HISTORY_SIZE];
+static SDL_atomic_t g_head = {0};
+
+
+int watch_add(u12_t start, u12_t end)
+{
+	u12_t i;
+
+	if (start > end || end >= MEMORY_SIZE) {
+		return -1;
+	}
+
+	for (i = start; i <= end; i++) {
+		if (!g_watched[i]) {
+			g_watched[i] = 1;
+			g_addresses[g_num++] = i;
+
+			if (i >= MEM_IO_ADDR && i < MEM_IO_ADDR + MEM_IO_SIZE) {
+				g_io_addresses[g_num_io++] = i;
+			}
+		}
+	}
+
+	return wp_watch_add(start, end);
+}
+
+int watch_add_str(char *str)
+{
+	char *end;
+	unsigned long start, stop;
+
+	/* <addr> or <addr>-<addr> */
+	start = strtoul(str, &end, 0);
+	if (end == str) {
+		return -1;
+	}
+
+	if (*end == '-') {
+		str = end + 1;
+		stop = strtoul(str, &end, 0);
+		if (end == str) {
+			return -1;
+		}
+	} else {
+		stop = start;
+	}
+
+	if (*end != '\0' || start >= MEMORY_SIZE || stop >= MEMORY_SIZE) {
+		return -1;
+	}
+
+	return watch_add(start, stop);
+}
+
+uint32_t watch_get_num(void)
+{
+	return g_num;
+}
+
+void watch_start(void)
+{
+	state_t *state = tamalib_get_state();
+	uint32_t i;
+
+	/* Changes made before that point (state loading) are not recorded */
+	for (i = 0; i < g_num; i++) {
+		g_shadow[g_addresses[i]] = GET_MEMORY(state->memory, g_addresses[i]);
+	}
+}
+
+/* Must be called after writing to the memory outside of the emulation
+ * (state loading, debugger, memory editor)
+ */
+void watch_request_scan(void)
+{
+	g_scan_requested = 1;
+}
+
+static void check_addr(u13_t pc, u12_t addr)
+{
+	state_t *state = tamalib_get_state();
+	watch_entry_t *entry;
+	uint32_t head;
+	u4_t val;
+
+	if (!g_watched[addr]) {
+		return;
+	}
+
+	val = GET_MEMORY(state->memory, addr);
+
+	/* Writing the same value is not a change */
+	if (val == g_shadow[addr]) {
+		return;
+	}
+
+	head = (uint32_t) SDL_AtomicGet(&g_head);
+	entry = &g_history[head & (WATCH_HISTORY_SIZE - 1)];
+
+	entry->tick = *(state->tick_counter);
+	entry->pc = pc;
+	entry->addr = addr;
+	entry->old_val = g_shadow[addr];
+	entry->new_val = val;
+
+	/* Publish the entry */
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&g_head, head + 1);
+
+	g_shadow[addr] = val;
+}
+
+/* Must be called after each step, pc being the address of the instruction
+ * that was executed (if any), wp_match() having been called before it.
+ * Only a few addresses are compared, whatever the size of the watched
+ * ranges: the ones written by the instruction, the watched I/O registers,
+ * and the top of the stack, where an interrupt pushes the PC.
+ */
+void watch_check(u13_t pc, bool_t executed)
+{
+	state_t *state = tamalib_get_state();
+	u12_t addrs[WP_ACCESS_MAX];
+	u4_t old_vals[WP_ACCESS_MAX];
+	uint32_t num, i;
+
+	if (g_scan_requested) {
+		g_scan_requested = 0;
+
+		for (i = 0; i < g_num; i++) {
+			check_addr(pc, g_addresses[i]);
+		}
+
+		return;
+	}
+
+	if (executed) {
+		num = wp_get_accesses(WP_WATCH, addrs, old_vals);
+
+		for (i = 0; i < num; i++) {
+			check_addr(pc, addrs[i]);
+		}
+	}
+
+	for (i = 0; i < g_num_io; i++) {
+		check_addr(pc, g_io_addresses[i]);
+	}
+
+	/* The stack lives in the first 256 nibbles of the RAM */
+	for (i = 0; i < 3; i++) {
+		check_addr(pc, (u8_t) (*(state->sp) + i));
+	}
+}
+
+uint32_t watch_get_history(watch_entry_t *entries, uint32_t max)
+{
+	uint32_t head, first, num, i;
+
+	head = (uint32_t) SDL_AtomicGet(&g_head);
+	SDL_MemoryBarrierAcquire();
+
+	num = (head < WATCH_HISTORY_SIZE) ? head : WATCH_HISTORY_SIZE;
+	if (num > max) {
+		num = max;
+	}
+
+	first = head - num;
+
+	for (i = 0; i < num; i++) {
+		entries[i] = g_history[(first + i) & (WATCH_HISTORY_SIZE - 1)];
+	}
+
+	/* Drop the entries that might have been overwritten while copying,
+	 * the slot of an entry being reused before the head reaches it again
+	 */
+	SDL_MemoryBarrierAcquire();
+	head = (uint32_t) SDL_AtomicGet(&g_head);
+	if (head - first >= WATCH_HISTORY_SIZE) {
+		i = head - first - WATCH_HISTORY_SIZE + 1;
+		if (i >= num) {
+			return 0;
+		}
+
+		memmove(entries, &entries[i], (num - i) * sizeof(watch_entry_t));
+		num -= i;
+	}
+
+	return num;
+}
+
+void watch_format_entry(char *buf, uint32_t len, watch_entry_t *entry)
+{
+	snprintf(buf, len, "%10u  PC 0x%04X  0x%03X: %X -> %X", entry->tick, entry->pc, entry->addr, entry->old_val, entry->new_val);
+}
+
+void watch_dump(char *path)
+{
+	watch_entry_t *entries;
+	uint32_t num, i;
+	char line[64];
+	FILE *fp;
+
+	entries = (watch_entry_t *) SDL_malloc(WATCH_HISTORY_SIZE * sizeof(watch_entry_t));
+	if (entries == NULL) {
+		return;
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "FATAL: Cannot create watch log \"%s\" !\n", path);
+		SDL_free(entries);
+		return;
+	}
+
+	num = watch_get_history(entries, WATCH_HISTORY_SIZE);
+
+	fprintf(fp, "      TICK  PC          ADDR: OLD -> NEW\n");
+	for (i = 0; i < num; i++) {
+		watch_format_entry(line, sizeof(line), &entries[i]);
+		fprintf(fp, "%s\n", line);
+	}
+
+	fclose(fp);
+	SDL_free(entries);
+}
@@ -0,0 +1,46 @@
+/*
+ * TamaTool - A Cross-Platform Explorer for First-Gen Tamagotchi
+ *
+ * Copyright (C) 2021 Jean-Christophe Rona <jc@rona.fr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "lib/tamalib.h"
+
+#define WATCH_HISTORY_SIZE		4096 // Must be a power of 2
+
+typedef struct {
+	u32_t tick;
+	u13_t pc;
+	u12_t addr;
+	u4_t old_val;
+	u4_t new_val;
+} watch_entry_t;
+
+
+int watch_add(u12_t start, u12_t end);
+int watch_add_str(char *str);
+uint32_t watch_get_num(void);
+void watch_start(void);
+void watch_request_scan(void);
+void watch_check(u13_t pc, bool_t executed);
+uint32_t watch_get_history(watch_entry_t *entries, uint32_t max);
+void watch_format_entry(char *buf, uint32_t len, watch_entry_t *entry);
+void watch_dump(char *path);
+
+#endif /* _WATCH_H_ */